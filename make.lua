@@ -11,3 +11,42 @@ lm:lua_dll "win32" {
         "src/*.cpp"
     }
 }
+
+lm:exe "test_exports" {
+    includes = {
+        "winmd"
+    },
+    sources = {
+        "test/test_exports.cpp"
+    }
+}
+
+lm:exe "bench_lazy_map" {
+    sources = {
+        "test/bench_lazy_map.cpp"
+    }
+}
+
+lm:exe "bench_parent_cursor" {
+    sources = {
+        "test/bench_parent_cursor.cpp"
+    }
+}
+
+lm:exe "test_thunk" {
+    sources = {
+        "test/test_thunk.cpp"
+    }
+}
+
+lm:exe "test_call_queue" {
+    sources = {
+        "test/test_call_queue.cpp"
+    }
+}
+
+lm:exe "bench_call_queue" {
+    sources = {
+        "test/bench_call_queue.cpp"
+    }
+}
@@ -1,10 +1,218 @@
 #pragma once
 
 #include <winmd_reader.h>
+#include "lazy_map.h"
+#include <string.h>
+#include <memory>
+#include <unordered_map>
 using namespace winmd::reader;
 
 namespace win32 {
-    struct cache {
+    // Attribute types interned at load, matched by namespace and name. GuidAttribute lives in
+    // System.Runtime.InteropServices (interfaces) or Windows.Win32.Foundation.Metadata (constants).
+    // Types past the well-known ones get the following IDs.
+    enum class attribute_id : uint8_t {
+        Guid,
+        Flags,
+        NativeTypedef,
+        NativeArrayInfo,
+        Const,
+        SupportedArchitecture,
+        RAIIFree,
+        NativeBitfield,
+        MemorySize,
+        ComOutPtr,
+        RetVal,
+        Reserved,
+        NotNullTerminated,
+        NullNullTerminated,
+        UnmanagedFunctionPointer,
+        FlexibleArray,
+        well_known,
+        unknown = 0xFF,
+    };
+
+    // Vtable layout of one COM interface, base interface slots first, computed once per process.
+    struct interface_info {
+        struct method {
+            MethodDef def;
+            uint32_t slot;
+        };
+        TypeDef type;
+        std::map<std::string_view, method> methods; // most derived method of each name
+        uint32_t slots = 0;
+    };
+
+    // How a NativeTypedef struct (HANDLE, BOOL, PWSTR...) is passed: as its single field.
+    enum class native_typedef : uint8_t {
+        none,     // not a NativeTypedef, or not a single scalar field
+        integer,  // integral field, see cache::underlying_type
+        boolean,  // BOOL and BOOLEAN
+        pointer,
+        string,   // pointer to 8 or 16 bit characters
+    };
+
+    // Native layout of a struct or union on this platform, computed once per process.
+    struct struct_info {
+        struct field {
+            Field def;
+            uint32_t offset;
+            uint32_t size; // whole field, fixed arrays included
+        };
+        // C bitfield packed into an integer field, from NativeBitfieldAttribute.
+        struct bitfield {
+            std::string_view name;
+            uint32_t field; // index in fields
+            uint32_t shift;
+            uint32_t length;
+        };
+        TypeDef type;
+        std::vector<field> fields;
+        std::vector<bitfield> bitfields;
+        uint32_t size = 0;
+        uint32_t align = 1;
+    };
+
+    // Enumerators of one enum type, decoded once per process.
+    struct enum_info {
+        struct enumerator {
+            int64_t value;
+            std::string_view name;
+        };
+        std::vector<enumerator> enumerators;  // metadata order
+        std::vector<enumerator> by_value;     // sorted by value, for reverse lookups
+        std::vector<enumerator> by_bits;      // [Flags] enums only: non-zero values, most bits first
+        bool flags = false;                   // the enum carries FlagsAttribute
+
+        enum_info(TypeDef const& type, bool is_flags)
+            : flags(is_flags)
+        {
+            auto fields = type.FieldList();
+            if (fields.first == fields.second) {
+                return;
+            }
+            parent_cursor<Constant> constants(type.get_database().Constant, fields.first.coded_index<HasConstant>());
+            for (auto&& field : fields) {
+                if (!field.Flags().Literal()) {
+                    continue;
+                }
+                auto range = constants.seek(field.coded_index<HasConstant>());
+                if (empty(range)) {
+                    continue;
+                }
+                auto constant = range.first;
+                int64_t value = std::visit([](auto&& v) -> int64_t {
+                    using T = std::decay_t<decltype(v)>;
+                    if constexpr (std::is_integral_v<T>) {
+                        return (int64_t)v;
+                    }
+                    else {
+                        return 0;
+                    }
+                }, constant.Value());
+                enumerators.push_back({ value, field.Name() });
+            }
+            by_value = enumerators;
+            std::stable_sort(by_value.begin(), by_value.end(), [](auto const& a, auto const& b) {
+                return a.value < b.value;
+            });
+            if (!flags) {
+                return;
+            }
+            for (auto const& e : enumerators) {
+                if (e.value != 0) {
+                    by_bits.push_back(e);
+                }
+            }
+            auto popcount = [](uint64_t v) {
+                int n = 0;
+                for (; v; v &= v - 1) {
+                    n++;
+                }
+                return n;
+            };
+            std::stable_sort(by_bits.begin(), by_bits.end(), [&](auto const& a, auto const& b) {
+                return popcount((uint64_t)a.value) > popcount((uint64_t)b.value);
+            });
+        }
+
+        enumerator const* find(int64_t value) const noexcept {
+            auto it = std::lower_bound(by_value.begin(), by_value.end(), value, [](auto const& e, int64_t v) {
+                return e.value < v;
+            });
+            if (it == by_value.end() || it->value != value) {
+                return nullptr;
+            }
+            return &*it;
+        }
+    };
+
+    // Value of a constant decoded ahead of time: a 64-bit payload and a tag telling how to read it.
+    // Strings and GUIDs keep the Constant/Field row in the payload and are materialized on first use.
+    struct constant_value {
+        enum class kind : uint8_t {
+            null,
+            boolean,
+            integer,
+            number,
+            string,
+            guid,
+        };
+        uint64_t payload;
+        kind type;
+
+        int64_t integer() const noexcept {
+            return (int64_t)payload;
+        }
+        double number() const noexcept {
+            double v;
+            memcpy(&v, &payload, sizeof(v));
+            return v;
+        }
+
+        static constant_value decode(Constant const& constant) {
+            auto integer = [](int64_t v) {
+                return constant_value { (uint64_t)v, kind::integer };
+            };
+            auto number = [](double v) {
+                constant_value r { 0, kind::number };
+                memcpy(&r.payload, &v, sizeof(v));
+                return r;
+            };
+            switch (constant.Type()) {
+            case ConstantType::Boolean: return { constant.ValueBoolean() ? 1u : 0u, kind::boolean };
+            case ConstantType::Char:    return integer(constant.ValueChar());
+            case ConstantType::Int8:    return integer(constant.ValueInt8());
+            case ConstantType::UInt8:   return integer(constant.ValueUInt8());
+            case ConstantType::Int16:   return integer(constant.ValueInt16());
+            case ConstantType::UInt16:  return integer(constant.ValueUInt16());
+            case ConstantType::Int32:   return integer(constant.ValueInt32());
+            case ConstantType::UInt32:  return integer(constant.ValueUInt32());
+            case ConstantType::Int64:   return integer(constant.ValueInt64());
+            case ConstantType::UInt64:  return integer((int64_t)constant.ValueUInt64());
+            case ConstantType::Float32: return number(constant.ValueFloat32());
+            case ConstantType::Float64: return number(constant.ValueFloat64());
+            case ConstantType::String:  return { constant.index(), kind::string };
+            default:                    return { 0, kind::null };
+            }
+        }
+
+        // A field without a Constant row is one of the GUID constants.
+        static constant_value decode(Field const& field) {
+            if (auto constant = field.Constant()) {
+                return decode(constant);
+            }
+            return { field.index(), kind::guid };
+        }
+    };
+
+    // Apis and constants declared by the types of one namespace.
+    struct namespace_index {
+        std::map<std::string_view, ImplMap> apis;
+        std::map<std::string_view, Field> constants;
+    };
+
+    struct cache final : winmd::reader::type_resolver {
         cache() = default;
         cache(cache const&) = delete;
         cache& operator=(cache const&) = delete;
@@ -26,9 +234,79 @@ namespace win32 {
             for (auto&& impl : db.ImplMap) {
                 m_apis.try_emplace(impl.ImportName(), impl);
             }
-            for (auto&& field : db.Field) {
-                m_constants.try_emplace(field.Name(), field.Constant());
+            intern_attributes();
+            // One pass over TypeDef, joined with its CustomAttribute rows for the GuidAttribute
+            // and NativeTypedefAttribute tests.
+            m_categories.resize(db.TypeDef.size());
+            m_underlying_types.resize(db.TypeDef.size(), ElementType::End);
+            m_typedef_kinds.resize(db.TypeDef.size(), native_typedef::none);
+            parent_cursor<CustomAttribute> attributes(db.CustomAttribute);
+            for (auto&& type : db.TypeDef) {
+                auto range = attributes.seek(type.coded_index<HasCustomAttribute>());
+                auto c = classify(type, range);
+                m_categories[type.index()] = (uint8_t)c;
+                if (c == category::struct_type) {
+                    m_typedef_kinds[type.index()] = classify_typedef(type, range);
+                    continue;
+                }
+                if (c != category::enum_type) {
+                    continue;
+                }
+                for (auto&& field : type.FieldList()) {
+                    if (!field.Flags().Static()) {
+                        m_underlying_types[type.index()] = std::get<ElementType>(field.Signature().Type().Type());
+                        break;
+                    }
+                }
             }
+            m_typerefs.resize(db.TypeRef.size());
+            for (auto&& ref : db.TypeRef) {
+                bind_typeref(ref);
+            }
+            // Literal fields are read from the Constant table, GUID constants (static fields with a
+            // GuidAttribute) from CustomAttribute, each in one pass over its parents. Both come out in
+            // Field order and are merged back into it.
+            std::vector<std::pair<uint32_t, constant_value>> values;
+            for_each_parent(db.Constant, [&](coded_index<HasConstant> const& parent, std::pair<Constant, Constant> const& range) {
+                if (parent.type() == HasConstant::Field) {
+                    values.push_back({ parent.index(), constant_value::decode(range.first) });
+                }
+            });
+            auto literals = values.size();
+            for_each_parent(db.CustomAttribute, [&](coded_index<HasCustomAttribute> const& parent, std::pair<CustomAttribute, CustomAttribute> const& range) {
+                if (parent.type() != HasCustomAttribute::Field) {
+                    return;
+                }
+                auto flags = db.Field[parent.index()].Flags();
+                if (!flags.Static() || flags.Literal()) {
+                    return;
+                }
+                for (auto&& attribute : range) {
+                    if (attribute_type(attribute) == attribute_id::Guid) {
+                        values.push_back({ parent.index(), { parent.index(), constant_value::kind::guid } });
+                        return;
+                    }
+                }
+            });
+            std::inplace_merge(values.begin(), values.begin() + literals, values.end(), [](auto const& a, auto const& b) {
+                return a.first < b.first;
+            });
+            m_constants.reserve(values.size());
+            m_constant_payloads.reserve(values.size());
+            m_constant_kinds.reserve(values.size());
+            for (auto const& [index, value] : values) {
+                m_constants.push_back({ db.Field[index].Name(), (uint32_t)m_constant_payloads.size() });
+                m_constant_payloads.push_back(value.payload);
+                m_constant_kinds.push_back(value.type);
+            }
+            // Keep the first definition of duplicated names, like the other indexes.
+            std::stable_sort(m_constants.begin(), m_constants.end(), [](auto const& a, auto const& b) {
+                return a.first < b.first;
+            });
+            m_constants.erase(std::unique(m_constants.begin(), m_constants.end(), [](auto const& a, auto const& b) {
+                return a.first == b.first;
+            }), m_constants.end());
+            m_constants.shrink_to_fit();
         }
 
         TypeDef find(std::string_view const& type_namespace, std::string_view const& type_name) const noexcept {
@@ -67,12 +345,300 @@ namespace win32 {
             return find_required(type_string.substr(0, pos), type_string.substr(pos + 1, type_string.size()));
         }
 
+        // TypeDef a TypeRef of this database points to, or an empty row. Resolved once at load time.
+        TypeDef find(TypeRef const& ref) const noexcept {
+            uint32_t row = m_typerefs[ref.index()];
+            return row ? m_database.TypeDef[row - 1] : TypeDef{};
+        }
+
+        TypeDef resolve(coded_index<TypeDefOrRef> const& type) const {
+            if (type.type() == TypeDefOrRef::TypeDef) {
+                return type.TypeDef();
+            }
+            auto ref = type.TypeRef();
+            auto definition = find(ref);
+            if (!definition) {
+                throw_invalid("Type '", ref.TypeNamespace(), ".", ref.TypeName(), "' could not be found");
+            }
+            return definition;
+        }
+
+        // type_resolver, for enum-typed attribute arguments. Empty rows for types defined elsewhere.
+        TypeDef resolve(TypeRef const& ref) const override {
+            return find(ref);
+        }
+
+        TypeDef resolve(std::string_view const& type_string) const override {
+            auto pos = type_string.rfind('.');
+            if (pos == std::string_view::npos) {
+                return {};
+            }
+            return find(type_string.substr(0, pos), type_string.substr(pos + 1));
+        }
+
+        category type_category(TypeDef const& type) const noexcept {
+            return (category)m_categories[type.index()];
+        }
+
+        bool is_enum(TypeDef const& type) const noexcept {
+            return type_category(type) == category::enum_type;
+        }
+
+        // Underlying integer type of an enum or integral NativeTypedef, ElementType::End for other types.
+        ElementType underlying_type(TypeDef const& type) const noexcept {
+            return m_underlying_types[type.index()];
+        }
+
+        native_typedef typedef_kind(TypeDef const& type) const noexcept {
+            return m_typedef_kinds[type.index()];
+        }
+
+        // ID of an attribute type by namespace-qualified name, with or without the "Attribute" suffix.
+        attribute_id find_attribute_type(std::string_view name) const {
+            auto it = m_attribute_names.find(name);
+            if (it == m_attribute_names.end()) {
+                std::string full { name };
+                full += "Attribute";
+                it = m_attribute_names.find(full);
+                if (it == m_attribute_names.end()) {
+                    return attribute_id::unknown;
+                }
+            }
+            return it->second;
+        }
+
+        attribute_id attribute_type(CustomAttribute const& attribute) const noexcept {
+            return m_attribute_types[attribute.index()];
+        }
+
+        template <typename Row>
+        bool has_attribute(Row const& row, attribute_id id) const {
+            if (id == attribute_id::unknown) {
+                return false;
+            }
+            if ((uint8_t)id < 32) {
+                return (attribute_mask(row.template coded_index<HasCustomAttribute>()) >> (uint8_t)id) & 1;
+            }
+            return (bool)find_attribute(row, id);
+        }
+
+        // Empty row when the row has no such attribute; unknown never matches.
+        template <typename Row>
+        CustomAttribute find_attribute(Row const& row, attribute_id id) const {
+            if (id == attribute_id::unknown) {
+                return {};
+            }
+            for (auto&& attribute : equal_range(m_database.CustomAttribute, row.template coded_index<HasCustomAttribute>())) {
+                if (attribute_type(attribute) == id) {
+                    return attribute;
+                }
+            }
+            return {};
+        }
+
+        // Decoded arguments of an attribute, parsed once per process.
+        CustomAttributeSig const& attribute_value(CustomAttribute const& attribute) const {
+            if (auto value = m_attribute_values.find(attribute.index())) {
+                return **value;
+            }
+            return *m_attribute_values.insert(attribute.index(), std::make_unique<CustomAttributeSig>(attribute.Value(*this)));
+        }
+
         auto find_api(std::string_view const& name) const {
             return tfind(m_apis, name);
         }
 
-        auto find_constant(std::string_view const& name) const {
-            return tfind(m_constants, name);
+        std::optional<constant_value> find_constant(std::string_view const& name) const noexcept {
+            auto it = std::lower_bound(m_constants.begin(), m_constants.end(), name, [](auto const& a, std::string_view const& b) {
+                return a.first < b;
+            });
+            if (it == m_constants.end() || it->first != name) {
+                return {};
+            }
+            return constant(it->second);
+        }
+
+        constant_value constant(uint32_t index) const noexcept {
+            return { m_constant_payloads[index], m_constant_kinds[index] };
+        }
+
+        // (name, index) pairs sorted by name, see constant().
+        auto const& constants() const noexcept {
+            return m_constants;
+        }
+
+        // Built on first use, so loading one namespace doesn't pay for the others.
+        namespace_index const* find_namespace(std::string_view const& name) const {
+            auto ns = m_namespaces.find(name);
+            if (ns == m_namespaces.end()) {
+                return nullptr;
+            }
+            if (auto index = m_namespace_indexes.find(ns->first)) {
+                return index->get();
+            }
+            auto index = std::make_unique<namespace_index>();
+            for (auto const& [type_name, type] : ns->second) {
+                for (auto&& method : type.MethodList()) {
+                    if (auto impl = find_impl(method)) {
+                        index->apis.try_emplace(impl.ImportName(), impl);
+                    }
+                }
+                for (auto&& field : type.FieldList()) {
+                    auto flags = field.Flags();
+                    if (flags.Static() && (flags.Literal() || has_attribute(field, attribute_id::Guid))) {
+                        index->constants.try_emplace(field.Name(), field);
+                    }
+                }
+            }
+            return m_namespace_indexes.insert(ns->first, std::move(index)).get();
+        }
+
+        ImplMap find_impl(MethodDef const& method) const {
+            // ImplMap is sorted by its MemberForwarded coded index, MethodDef tag is 1.
+            uint32_t key = ((method.index() + 1) << 1) | 1;
+            auto const& table = m_database.ImplMap;
+            auto it = std::lower_bound(table.begin(), table.end(), key, [](ImplMap const& impl, uint32_t key) {
+                return impl.get_value<uint32_t>(1) < key;
+            });
+            if (it == table.end() || it.get_value<uint32_t>(1) != key) {
+                return {};
+            }
+            return it;
+        }
+
+        // UTF-8 copy of a string constant, decoded once per process.
+        std::string_view string_constant(Constant const& constant) const {
+            if (auto str = m_strings.find(constant.index())) {
+                return *str;
+            }
+            return m_strings.insert(constant.index(), to_utf8(constant.ValueString()));
+        }
+
+        // 16 bytes GUID from the GuidAttribute of a field, or nullptr. The storage lives as long as the cache.
+        uint8_t const* guid_constant(Field const& field) const {
+            auto guid = m_guids.find(field.index());
+            if (!guid) {
+                guid = &m_guids.insert(field.index(), parse_guid(field));
+            }
+            return *guid ? (*guid)->data() : nullptr;
+        }
+
+        enum_info const& enum_definition(TypeDef const& type) const {
+            if (auto info = m_enums.find(type.index())) {
+                return **info;
+            }
+            return *m_enums.insert(type.index(), std::make_unique<enum_info>(type, has_attribute(type, attribute_id::Flags)));
+        }
+
+        // Throws std::invalid_argument when a base interface cannot be resolved.
+        interface_info const& interface_definition(TypeDef const& type) const {
+            if (auto info = m_interfaces.find(type.index())) {
+                return **info;
+            }
+            auto info = std::make_unique<interface_info>();
+            info->type = type;
+            auto bases = type.InterfaceImpl();
+            if (bases.first != bases.second) {
+                auto const& base = interface_definition(resolve(bases.first.Interface()));
+                info->methods = base.methods;
+                info->slots = base.slots;
+            }
+            uint32_t first = info->slots;
+            for (auto&& method : type.MethodList()) {
+                auto& m = info->methods[method.Name()];
+                // Overloads within one interface keep the first slot; base methods are shadowed.
+                if (!m.def || m.slot < first) {
+                    m = { method, info->slots };
+                }
+                ++info->slots;
+            }
+            return *m_interfaces.insert(type.index(), std::move(info));
+        }
+
+        // Throws std::invalid_argument for fields without a native layout.
+        struct_info const& struct_layout(TypeDef const& type) const {
+            if (auto info = m_structs.find(type.index())) {
+                return **info;
+            }
+            auto info = std::make_unique<struct_info>();
+            info->type = type;
+            uint32_t pack = 0;
+            uint32_t class_size = 0;
+            auto layout = equal_range(m_database.ClassLayout, type);
+            if (layout.first != layout.second) {
+                pack = layout.first.PackingSize();
+                class_size = layout.first.ClassSize();
+            }
+            bool is_explicit = type.Flags().Layout() == TypeLayout::ExplicitLayout;
+            uint32_t end = 0;
+            for (auto&& field : type.FieldList()) {
+                if (field.Flags().Static()) {
+                    continue;
+                }
+                auto [size, align] = type_layout(field.Signature().Type());
+                if (pack && align > pack) {
+                    align = pack;
+                }
+                uint32_t offset = is_explicit
+                    ? field_offset(field)
+                    : (end + align - 1) / align * align;
+                end = std::max(end, offset + size);
+                info->align = std::max(info->align, align);
+                for (auto&& attribute : equal_range(m_database.CustomAttribute, field.coded_index<HasCustomAttribute>())) {
+                    if (attribute_type(attribute) == attribute_id::NativeBitfield) {
+                        info->bitfields.push_back(bitfield_value((uint32_t)info->fields.size(), attribute));
+                    }
+                }
+                info->fields.push_back({ field, offset, size });
+            }
+            info->size = std::max((end + info->align - 1) / info->align * info->align, class_size);
+            return *m_structs.insert(type.index(), std::move(info));
+        }
+
+        // Size and alignment of a field or parameter type.
+        std::pair<uint32_t, uint32_t> type_layout(TypeSig const& type) const {
+            uint32_t count = 1;
+            if (type.is_array()) {
+                for (auto n : type.array_sizes()) {
+                    count *= n;
+                }
+            }
+            if (type.ptr_count() > 0) {
+                return { (uint32_t)sizeof(void*) * count, (uint32_t)sizeof(void*) };
+            }
+            if (type.element_type() == ElementType::ValueType) {
+                auto def = resolve(std::get<coded_index<TypeDefOrRef>>(type.Type()));
+                if (is_enum(def)) {
+                    auto size = element_size(underlying_type(def));
+                    return { size * count, size };
+                }
+                auto const& info = struct_layout(def);
+                return { info.size * count, info.align };
+            }
+            auto size = element_size(type.element_type());
+            if (!size) {
+                throw_invalid("Type without a native layout encountered.");
+            }
+            return { size * count, size };
+        }
+
+        // Type of a category by bare name (first match across namespaces) or by full name.
+        TypeDef find_type(std::string_view const& name, category c) const {
+            if (name.find('.') != std::string_view::npos) {
+                auto type = find(name);
+                return type && type_category(type) == c ? type : TypeDef{};
+            }
+            for (auto const& [ns, members] : m_namespaces) {
+                auto it = members.find(name);
+                if (it != members.end() && type_category(it->second) == c) {
+                    return it->second;
+                }
+            }
+            return {};
+        }
+
+        TypeDef find_enum(std::string_view const& name) const {
+            return find_type(name, category::enum_type);
         }
 
         auto const& database() const noexcept {
@@ -103,7 +669,346 @@ namespace win32 {
         using namespace_members = std::map<std::string_view, TypeDef>;
         using namespace_type = std::pair<std::string_view const, namespace_members> const&;
 
+        static std::string to_utf8(std::u16string_view const& str) {
+            std::string r;
+            r.reserve(str.size());
+            for (size_t i = 0; i < str.size(); ++i) {
+                uint32_t c = str[i];
+                if (c >= 0xD800 && c <= 0xDBFF && i + 1 < str.size() && str[i + 1] >= 0xDC00 && str[i + 1] <= 0xDFFF) {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (str[++i] - 0xDC00);
+                }
+                if (c < 0x80) {
+                    r += (char)c;
+                }
+                else if (c < 0x800) {
+                    r += (char)(0xC0 | (c >> 6));
+                    r += (char)(0x80 | (c & 0x3F));
+                }
+                else if (c < 0x10000) {
+                    r += (char)(0xE0 | (c >> 12));
+                    r += (char)(0x80 | ((c >> 6) & 0x3F));
+                    r += (char)(0x80 | (c & 0x3F));
+                }
+                else {
+                    r += (char)(0xF0 | (c >> 18));
+                    r += (char)(0x80 | ((c >> 12) & 0x3F));
+                    r += (char)(0x80 | ((c >> 6) & 0x3F));
+                    r += (char)(0x80 | (c & 0x3F));
+                }
+            }
+            return r;
+        }
+
     private:
+        using guid_type = std::array<uint8_t, 16>;
+
+        // 0 for types that are not scalars.
+        static uint32_t element_size(ElementType type) noexcept {
+            switch (type) {
+            case ElementType::Boolean:
+            case ElementType::I1:
+            case ElementType::U1:
+                return 1;
+            case ElementType::Char:
+            case ElementType::I2:
+            case ElementType::U2:
+                return 2;
+            case ElementType::I4:
+            case ElementType::U4:
+            case ElementType::R4:
+                return 4;
+            case ElementType::I8:
+            case ElementType::U8:
+            case ElementType::R8:
+                return 8;
+            case ElementType::I:
+            case ElementType::U:
+            case ElementType::Class: // delegates are function pointers
+                return sizeof(void*);
+            default:
+                return 0;
+            }
+        }
+
+        // NativeBitfieldAttribute(string name, long offset, long length)
+        struct_info::bitfield bitfield_value(uint32_t field, CustomAttribute const& attribute) const {
+            auto const& args = attribute_value(attribute).FixedArgs();
+            auto arg = [&](size_t i) -> ElemSig::value_type const& {
+                if (i >= args.size() || !std::holds_alternative<ElemSig>(args[i].value)) {
+                    throw_invalid("Malformed NativeBitfieldAttribute");
+                }
+                return std::get<ElemSig>(args[i].value).value;
+            };
+            auto integer = [&](size_t i) -> uint32_t {
+                return std::visit([](auto&& v) -> uint32_t {
+                    using T = std::decay_t<decltype(v)>;
+                    if constexpr (std::is_integral_v<T>) {
+                        return (uint32_t)v;
+                    }
+                    else {
+                        throw_invalid("Malformed NativeBitfieldAttribute");
+                    }
+                }, arg(i));
+            };
+            auto const* name = std::get_if<std::string_view>(&arg(0));
+            if (!name) {
+                throw_invalid("Malformed NativeBitfieldAttribute");
+            }
+            return { *name, field, integer(1), integer(2) };
+        }
+
+        uint32_t field_offset(Field const& field) const {
+            auto const& table = m_database.FieldLayout;
+            auto it = std::lower_bound(table.begin(), table.end(), field, [](FieldLayout const& row, Field const& field) {
+                return row.Field() < field;
+            });
+            if (it == table.end() || it.Field() != field) {
+                throw_invalid("Field '", field.Name(), "' has no explicit offset");
+            }
+            return it.Offset();
+        }
+
+        // A GuidAttribute whose arguments don't have the expected types gives no GUID.
+        std::optional<guid_type> parse_guid(Field const& field) const {
+            auto attribute = find_attribute(field, attribute_id::Guid);
+            if (!attribute) {
+                return {};
+            }
+            auto const& args = attribute_value(attribute).FixedArgs();
+            auto arg = [&](size_t i, auto& out) {
+                using T = std::decay_t<decltype(out)>;
+                auto elem = std::get_if<ElemSig>(&args[i].value);
+                auto value = elem ? std::get_if<T>(&elem->value) : nullptr;
+                if (value) {
+                    out = *value;
+                }
+                return value != nullptr;
+            };
+            guid_type guid {};
+            if (args.size() == 11) {
+                uint32_t data1;
+                uint16_t data2;
+                uint16_t data3;
+                if (!arg(0, data1) || !arg(1, data2) || !arg(2, data3)) {
+                    return {};
+                }
+                memcpy(&guid[0], &data1, sizeof(data1));
+                memcpy(&guid[4], &data2, sizeof(data2));
+                memcpy(&guid[6], &data3, sizeof(data3));
+                for (size_t i = 0; i < 8; ++i) {
+                    if (!arg(3 + i, guid[8 + i])) {
+                        return {};
+                    }
+                }
+                return guid;
+            }
+            if (args.size() == 1) {
+                // "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+                std::string_view str;
+                if (!arg(0, str)) {
+                    return {};
+                }
+                uint8_t bytes[16];
+                size_t n = 0;
+                for (size_t i = 0; i + 1 < str.size() && n < 16; ++i) {
+                    if (str[i] == '-' || str[i] == '{') {
+                        continue;
+                    }
+                    auto hex = [](char c) -> int {
+                        if (c >= '0' && c <= '9') return c - '0';
+                        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+                        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+                        return -1;
+                    };
+                    int h = hex(str[i]), l = hex(str[i + 1]);
+                    if (h < 0 || l < 0) {
+                        break;
+                    }
+                    bytes[n++] = (uint8_t)(h << 4 | l);
+                    ++i;
+                }
+                if (n != 16) {
+                    return {};
+                }
+                // The string form is big endian for the first three groups.
+                uint32_t data1 = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+                uint16_t data2 = (uint16_t)(bytes[4] << 8 | bytes[5]);
+                uint16_t data3 = (uint16_t)(bytes[6] << 8 | bytes[7]);
+                memcpy(&guid[0], &data1, sizeof(data1));
+                memcpy(&guid[4], &data2, sizeof(data2));
+                memcpy(&guid[6], &data3, sizeof(data3));
+                memcpy(&guid[8], &bytes[8], 8);
+                return guid;
+            }
+            return {};
+        }
+
+        void intern_attributes() {
+            static constexpr std::pair<attribute_id, std::string_view> well_known[] = {
+                { attribute_id::Guid, "System.Runtime.InteropServices.GuidAttribute" },
+                { attribute_id::Guid, "Windows.Win32.Foundation.Metadata.GuidAttribute" },
+                { attribute_id::Flags, "System.FlagsAttribute" },
+                { attribute_id::NativeTypedef, "Windows.Win32.Foundation.Metadata.NativeTypedefAttribute" },
+                { attribute_id::NativeArrayInfo, "Windows.Win32.Foundation.Metadata.NativeArrayInfoAttribute" },
+                { attribute_id::Const, "Windows.Win32.Foundation.Metadata.ConstAttribute" },
+                { attribute_id::SupportedArchitecture, "Windows.Win32.Foundation.Metadata.SupportedArchitectureAttribute" },
+                { attribute_id::RAIIFree, "Windows.Win32.Foundation.Metadata.RAIIFreeAttribute" },
+                { attribute_id::NativeBitfield, "Windows.Win32.Foundation.Metadata.NativeBitfieldAttribute" },
+                { attribute_id::MemorySize, "Windows.Win32.Foundation.Metadata.MemorySizeAttribute" },
+                { attribute_id::ComOutPtr, "Windows.Win32.Foundation.Metadata.ComOutPtrAttribute" },
+                { attribute_id::RetVal, "Windows.Win32.Foundation.Metadata.RetValAttribute" },
+                { attribute_id::Reserved, "Windows.Win32.Foundation.Metadata.ReservedAttribute" },
+                { attribute_id::NotNullTerminated, "Windows.Win32.Foundation.Metadata.NotNullTerminatedAttribute" },
+                { attribute_id::NullNullTerminated, "Windows.Win32.Foundation.Metadata.NullNullTerminatedAttribute" },
+                { attribute_id::UnmanagedFunctionPointer, "System.Runtime.InteropServices.UnmanagedFunctionPointerAttribute" },
+                { attribute_id::FlexibleArray, "Windows.Win32.Foundation.Metadata.FlexibleArrayAttribute" },
+            };
+            for (auto const& [id, name] : well_known) {
+                m_attribute_names.emplace(name, id);
+            }
+            uint32_t next_id = (uint32_t)attribute_id::well_known;
+            // Many rows share a constructor, so its type name is resolved once per constructor.
+            std::unordered_map<uint32_t, attribute_id> constructors;
+            std::string name;
+            auto const& table = m_database.CustomAttribute;
+            m_attribute_types.resize(table.size(), attribute_id::unknown);
+            for (auto&& attribute : table) {
+                auto ctor = attribute.Type();
+                uint32_t key = (ctor.index() << 3) | (uint32_t)ctor.type();
+                auto it = constructors.find(key);
+                if (it == constructors.end()) {
+                    auto [type_namespace, type_name] = attribute.TypeNamespaceAndName();
+                    name.assign(type_namespace).append(".").append(type_name);
+                    auto id = attribute_id::unknown;
+                    auto known = m_attribute_names.find(name);
+                    if (known != m_attribute_names.end()) {
+                        id = known->second;
+                    }
+                    else if (next_id < (uint32_t)attribute_id::unknown) {
+                        id = (attribute_id)next_id++;
+                        m_attribute_names.emplace(name, id);
+                    }
+                    it = constructors.emplace(key, id).first;
+                }
+                auto id = it->second;
+                m_attribute_types[attribute.index()] = id;
+                // Rows are sorted by parent, so each mask vector grows at its end.
+                if ((uint32_t)id < 32) {
+                    auto parent = attribute.Parent();
+                    auto& masks = m_attribute_masks[(size_t)parent.type()];
+                    if (masks.size() <= parent.index()) {
+                        masks.resize(parent.index() + 1);
+                    }
+                    masks[parent.index()] |= (uint32_t)1 << (uint32_t)id;
+                }
+            }
+        }
+
+        // Bit i is set when the row carries an attribute of ID i < 32.
+        uint32_t attribute_mask(coded_index<HasCustomAttribute> const& parent) const noexcept {
+            auto const& masks = m_attribute_masks[(size_t)parent.type()];
+            return parent.index() < masks.size() ? masks[parent.index()] : 0;
+        }
+
+        // Same rules as winmd::reader::get_category, with the type's attributes already at hand.
+        static category classify(TypeDef const& type, std::pair<CustomAttribute, CustomAttribute> const& attributes) {
+            if (type.Flags().Semantics() == TypeSemantics::Interface) {
+                return category::interface_type;
+            }
+            for (auto&& attribute : attributes) {
+                auto pair = attribute.TypeNamespaceAndName();
+                if (pair.second == "GuidAttribute" && pair.first == "System.Runtime.InteropServices") {
+                    return category::interface_type;
+                }
+            }
+            if (!type.Extends()) {
+                return category::class_type;
+            }
+            auto [extends_namespace, extends_name] = get_base_class_namespace_and_name(type);
+            if (extends_namespace != "System") {
+                return category::class_type;
+            }
+            if (extends_name == "Enum") {
+                return category::enum_type;
+            }
+            if (extends_name == "ValueType") {
+                return category::struct_type;
+            }
+            if (extends_name == "MulticastDelegate") {
+                return category::delegate_type;
+            }
+            return category::class_type;
+        }
+
+        native_typedef classify_typedef(TypeDef const& type, std::pair<CustomAttribute, CustomAttribute> const& attributes) {
+            auto is_typedef = std::any_of(attributes.first, attributes.second, [this](auto&& attribute) {
+                return attribute_type(attribute) == attribute_id::NativeTypedef;
+            });
+            if (!is_typedef) {
+                return native_typedef::none;
+            }
+            Field value;
+            for (auto&& field : type.FieldList()) {
+                if (field.Flags().Static()) {
+                    continue;
+                }
+                if (value) {
+                    return native_typedef::none;
+                }
+                value = field;
+            }
+            if (!value) {
+                return native_typedef::none;
+            }
+            auto sig = value.Signature().Type();
+            auto e = sig.element_type();
+            if (sig.ptr_count() > 0) {
+                bool chars = sig.ptr_count() == 1 && (e == ElementType::U1 || e == ElementType::I1 || e == ElementType::Char);
+                return chars ? native_typedef::string : native_typedef::pointer;
+            }
+            switch (e) {
+            case ElementType::I1:
+            case ElementType::U1:
+            case ElementType::I2:
+            case ElementType::U2:
+            case ElementType::I4:
+            case ElementType::U4:
+            case ElementType::I8:
+            case ElementType::U8:
+            case ElementType::I:
+            case ElementType::U:
+                m_underlying_types[type.index()] = e;
+                return type.TypeName() == "BOOL" || type.TypeName() == "BOOLEAN"
+                    ? native_typedef::boolean
+                    : native_typedef::integer;
+            default:
+                return native_typedef::none;
+            }
+        }
+
+        TypeDef bind_typeref(TypeRef const& ref) {
+            if (uint32_t row = m_typerefs[ref.index()]) {
+                return m_database.TypeDef[row - 1];
+            }
+            TypeDef definition;
+            auto scope = ref.ResolutionScope();
+            if (scope.type() != ResolutionScope::TypeRef) {
+                definition = find(ref.TypeNamespace(), ref.TypeName());
+            }
+            else if (auto enclosing = bind_typeref(scope.TypeRef())) {
+                for (auto const& nested : nested_types(enclosing)) {
+                    if (nested.TypeName() == ref.TypeName()) {
+                        definition = nested;
+                        break;
+                    }
+                }
+            }
+            if (definition) {
+                m_typerefs[ref.index()] = definition.index() + 1;
+            }
+            return definition;
+        }
+
         template <typename T>
         static const T* tfind(std::map<std::string_view, T> const& m, std::string_view const& name) noexcept {
             auto it = m.find(name);
@@ -118,6 +1023,22 @@ namespace win32 {
         std::map<std::string_view, namespace_members> m_namespaces;
         std::map<TypeDef, std::vector<TypeDef>> m_nested_types;
         std::map<std::string_view, ImplMap> m_apis;
-        std::map<std::string_view, Constant> m_constants;
+        std::vector<uint8_t> m_categories;        // TypeDef row -> category
+        std::vector<ElementType> m_underlying_types; // TypeDef row -> enum or NativeTypedef underlying type
+        std::vector<native_typedef> m_typedef_kinds; // TypeDef row
+        std::map<std::string, attribute_id, std::less<>> m_attribute_names; // "Namespace.NameAttribute"
+        std::vector<attribute_id> m_attribute_types; // CustomAttribute row -> attribute type
+        std::array<std::vector<uint32_t>, (size_t)HasCustomAttribute::MethodSpec + 1> m_attribute_masks; // parent row -> attribute_mask
+        std::vector<uint32_t> m_typerefs; // TypeRef row -> TypeDef row + 1, 0 when unresolved
+        std::vector<std::pair<std::string_view, uint32_t>> m_constants;
+        std::vector<uint64_t> m_constant_payloads;
+        std::vector<constant_value::kind> m_constant_kinds;
+        mutable lazy_map<uint32_t, std::string> m_strings;
+        mutable lazy_map<uint32_t, std::optional<guid_type>> m_guids;
+        mutable lazy_map<uint32_t, std::unique_ptr<enum_info>> m_enums;
+        mutable lazy_map<uint32_t, std::unique_ptr<interface_info>> m_interfaces;
+        mutable lazy_map<uint32_t, std::unique_ptr<struct_info>> m_structs;
+        mutable lazy_map<uint32_t, std::unique_ptr<CustomAttributeSig>> m_attribute_values;
+        mutable lazy_map<std::string_view, std::unique_ptr<namespace_index>> m_namespace_indexes;
     };
 }
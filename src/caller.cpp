@@ -1,36 +1,63 @@
 #include "caller.h"
 #include <array>
+#include <algorithm>
+#include <optional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string.h>
 #include <utility>
 #include "cache.h"
+#include "lazy_map.h"
+#include "thunk.h"
+#include "mpsc.h"
 
 using namespace winmd::reader;
 
 namespace win32 {
     
-    static TypeDef resolve_type(win32::cache const& cache, coded_index<TypeDefOrRef> const& type_index) {
-        if (type_index.type() == TypeDefOrRef::TypeDef) {
-            return type_index.TypeDef();
-        }
-        auto const& typeref = type_index.TypeRef();
-        return cache.find_required(typeref.TypeNamespace(), typeref.TypeName());
-    };
-
     using fromlua_t = std::function<uintptr_t(lua_State*,int)>;
-    using generate_fromlua_t = std::function<fromlua_t(ParamAttributes)>;
 
-    fromlua_t fromlua_invalid = [](lua_State*,int) { return 0; };
+    void* userdata_pointer(lua_State* L, int idx) {
+        void* p = lua_touserdata(L, idx);
+        if (lua_getmetatable(L, idx)) {
+            bool boxed = lua_rawgetp(L, -1, &boxed_pointer_key) != LUA_TNIL;
+            lua_pop(L, 2);
+            if (boxed) {
+                return *(void**)p;
+            }
+        }
+        return p;
+    }
+
     fromlua_t fromlua_void = [](lua_State*,int) { return 0; };
     fromlua_t fromlua_integer = [](lua_State* L,int idx) { return luaL_checkinteger(L, idx); };
+    // Pointers are userdata, light userdata or integer addresses (as returned by pointer results); nil is NULL.
+    // An interface object passes the COM pointer it holds.
     fromlua_t fromlua_pointer = [](lua_State* L,int idx)->uintptr_t {
         switch (lua_type(L, idx)) {
         case LUA_TNIL:
             return 0;
+        case LUA_TUSERDATA:
+            return (uintptr_t)userdata_pointer(L, idx);
+        case LUA_TLIGHTUSERDATA:
+            return (uintptr_t)lua_touserdata(L, idx);
+        case LUA_TNUMBER:
+            return (uintptr_t)luaL_checkinteger(L, idx);
         default:
             luaL_checktype(L, idx, LUA_TUSERDATA);
-            return (uintptr_t)lua_touserdata(L, idx);
+            return 0;
         }
-        return 0;
     };
+    // Input-only pointers also take strings, as read-only bytes (GUID constants, packed structs).
+    fromlua_t fromlua_in_pointer = [](lua_State* L,int idx)->uintptr_t {
+        if (lua_type(L, idx) == LUA_TSTRING) {
+            return (uintptr_t)lua_tostring(L, idx);
+        }
+        return fromlua_pointer(L, idx);
+    };
+    // Strings are Lua strings (input only) or buffers. A number is converted to its text like
+    // luaL_checkstring does, never taken as an address: raw addresses go to pointer parameters.
     auto fromlua_string = [](ParamAttributes attribute)->fromlua_t {
         if (attribute.Out()) {
             if (!attribute.Optional()) {
@@ -53,6 +80,7 @@ namespace win32 {
             return [](lua_State* L, int idx)->uintptr_t {
                 switch (lua_type(L, idx)) {
                 case LUA_TUSERDATA:
+                case LUA_TLIGHTUSERDATA:
                     return (uintptr_t)lua_touserdata(L, idx);
                 default:
                     return (uintptr_t)luaL_checkstring(L, idx);
@@ -64,25 +92,117 @@ namespace win32 {
             case LUA_TNIL:
                 return 0;
             case LUA_TUSERDATA:
+            case LUA_TLIGHTUSERDATA:
                 return (uintptr_t)lua_touserdata(L, idx);
             default:
                 return (uintptr_t)luaL_checkstring(L, idx);
             }
         };
     };
-    std::map<std::string_view, generate_fromlua_t> FromLua = {
-        { "HWND", [](ParamAttributes attribute) {
-            return [](lua_State* L, int idx)->uintptr_t {
-                //TODO
-                return 0;
-            };
-        }},
-        { "PSTR", fromlua_string },
-        { "PWSTR", fromlua_string }
+    fromlua_t fromlua_boolean = [](lua_State* L, int idx)->uintptr_t {
+        if (lua_isboolean(L, idx)) {
+            return lua_toboolean(L, idx);
+        }
+        return luaL_checkinteger(L, idx);
     };
+    // Interfaces are reference types: a parameter of interface type is the COM pointer itself.
+    static bool is_interface(const win32::cache* cache, TypeSig const& type) {
+        if (type.ptr_count() > 0 || type.element_type() != ElementType::Class) {
+            return false;
+        }
+        auto def = cache->resolve(std::get<coded_index<TypeDefOrRef>>(type.Type()));
+        return cache->type_category(def) == category::interface_type;
+    }
+
+    static bool is_integer(ElementType type) {
+        switch (type) {
+        case ElementType::I1:
+        case ElementType::U1:
+        case ElementType::I2:
+        case ElementType::U2:
+        case ElementType::I4:
+        case ElementType::U4:
+        case ElementType::I8:
+        case ElementType::U8:
+        case ElementType::U:
+        case ElementType::I:
+            return true;
+        default:
+            return false;
+        }
+    }
 
-    static fromlua_t fromlua(lua_State* L, const win32::cache* cache, TypeSig type, ParamAttributes attribute, int idx) {
+    // Structs of 1, 2, 4 and 8 bytes travel in a register as an integer, others by reference.
+    static bool struct_in_register(uint32_t size) {
+        return size == 1 || size == 2 || size == 4 || size == 8;
+    }
+
+    // Bytes of a struct value: a string, a userdata, or an address.
+    static void const* check_struct(lua_State* L, int idx, uint32_t size) {
+        switch (lua_type(L, idx)) {
+        case LUA_TSTRING: {
+            size_t len = 0;
+            auto str = lua_tolstring(L, idx, &len);
+            luaL_argcheck(L, len >= size, idx, "struct too short");
+            return str;
+        }
+        case LUA_TUSERDATA: {
+            void* p = userdata_pointer(L, idx);
+            // A struct view aliases bytes it can't measure.
+            luaL_argcheck(L, p != lua_touserdata(L, idx) || lua_rawlen(L, idx) >= size, idx, "struct too short");
+            return p;
+        }
+        case LUA_TLIGHTUSERDATA:
+            return lua_touserdata(L, idx);
+        case LUA_TNUMBER:
+            return (void const*)(uintptr_t)luaL_checkinteger(L, idx);
+        default:
+            luaL_typeerror(L, idx, "struct");
+            return nullptr;
+        }
+    }
+
+    // Plan of a struct result, nullptr when a field has no Lua representation.
+    static struct_plan const* result_plan(const win32::cache* cache, TypeDef const& type) {
+        try {
+            return compile_struct(cache, type);
+        } catch (std::invalid_argument const&) {
+            return nullptr;
+        }
+    }
+
+    // Struct results are win32::struct userdata of their type, or plain win32::memory without a plan.
+    static void* new_struct(lua_State* L, struct_plan const* plan, uint32_t size) {
+        if (plan) {
+            return push_struct(L, plan);
+        }
+        void* p = lua_newuserdatauv(L, size, 1);
+        luaL_setmetatable(L, "win32::memory");
+        return p;
+    }
+
+    static fromlua_t fromlua_struct(uint32_t size) {
+        if (struct_in_register(size) && size <= sizeof(uintptr_t)) {
+            return [size](lua_State* L, int idx)->uintptr_t {
+                uintptr_t v = 0;
+                memcpy(&v, check_struct(L, idx, size), size);
+                return v;
+            };
+        }
+        // The callee owns the copy, which lives on the Lua stack until the call returns.
+        return [size](lua_State* L, int idx)->uintptr_t {
+            void const* src = check_struct(L, idx, size);
+            void* copy = lua_newuserdatauv(L, size, 0);
+            memcpy(copy, src, size);
+            return (uintptr_t)copy;
+        };
+    }
+
+    static fromlua_t fromlua(const win32::cache* cache, TypeSig type, ParamAttributes attribute, int idx) {
         if (type.ptr_count() > 0) {
+            return attribute.Out() ? fromlua_pointer : fromlua_in_pointer;
+        }
+        if (is_interface(cache, type)) {
             return fromlua_pointer;
         }
         switch (type.element_type()) {
@@ -90,34 +210,33 @@ namespace win32 {
             return fromlua_void;
         case ElementType::ValueType: {
             auto& type_index = std::get<coded_index<TypeDefOrRef>>(type.Type());
-            auto def = resolve_type(*cache, type_index);
-            auto name = def.TypeName();
-            if (def.is_enum()) {
-                auto const& enum_def = def.get_enum_definition();
-                switch (enum_def.m_underlying_type) {
-                case ElementType::I1:
-                case ElementType::U1:
-                case ElementType::I2:
-                case ElementType::U2:
-                case ElementType::I4:
-                case ElementType::U4:
-                case ElementType::I8:
-                case ElementType::U8:
-                case ElementType::U:
-                case ElementType::I:
-                    return fromlua_integer;
-                default:
-                    break;
-                }
-                luaL_error(L, "#%d Unrecognized %s encountered.", idx, name.data());
-                return fromlua_invalid;
+            auto def = cache->resolve(type_index);
+            if (cache->is_enum(def) && is_integer(cache->underlying_type(def))) {
+                return fromlua_integer;
             }
-            auto it = FromLua.find(name);
-            if (it == FromLua.end()) {
-                luaL_error(L, "#%d Unrecognized %s encountered.", idx, name.data());
-                return fromlua_invalid;
+            switch (cache->typedef_kind(def)) {
+            case native_typedef::integer: {
+                auto e = cache->underlying_type(def);
+                return e == ElementType::I || e == ElementType::U ? fromlua_pointer : fromlua_integer;
             }
-            return it->second(attribute);
+            case native_typedef::boolean:
+                return fromlua_boolean;
+            case native_typedef::pointer:
+                return fromlua_pointer;
+            case native_typedef::string:
+                return fromlua_string(attribute);
+            default:
+                break;
+            }
+            if (cache->type_category(def) == category::struct_type) {
+                uint32_t size = cache->struct_layout(def).size;
+                // x86 pushes structs by value onto the stack, which only a register-sized argument of the same size expresses.
+                if (sizeof(void*) == 4 && size != 1 && size != 2 && size != 4) {
+                    cache::throw_invalid("#", std::to_string(idx), " ", def.TypeName(), " can't be passed by value on this platform.");
+                }
+                return fromlua_struct(size);
+            }
+            cache::throw_invalid("#", std::to_string(idx), " Unrecognized ", def.TypeName(), " encountered.");
         }
         case ElementType::I1:
         case ElementType::U1:
@@ -141,14 +260,12 @@ namespace win32 {
         case ElementType::Var:
         case ElementType::MVar:
         default:
-            luaL_error(L, "#%d Unrecognized ELEMENT_TYPE encountered.", idx);
-            return fromlua_invalid;
+            cache::throw_invalid("#", std::to_string(idx), " Unrecognized ELEMENT_TYPE encountered.");
         }
     }
 
     using tolua_t = std::function<int(lua_State*,uintptr_t)>;
 
-    tolua_t tolua_invalid = [](lua_State*, uintptr_t) { return 0; };
     tolua_t tolua_void = [](lua_State*, uintptr_t) { return 0; };
     tolua_t tolua_integer = [](lua_State* L, uintptr_t v) {
         lua_pushinteger(L, v);
@@ -158,46 +275,59 @@ namespace win32 {
         lua_pushboolean(L, v? 1: 0);
         return 1;
     };
+    // Only the low bytes of a narrow result are defined; signed results are sign extended.
+    template <typename T>
+    int tolua_narrow(lua_State* L, uintptr_t v) {
+        lua_pushinteger(L, (lua_Integer)(T)v);
+        return 1;
+    }
 
-    std::map<std::string_view, tolua_t> ToLua = {
-        { "BOOL", tolua_boolean }
-    };
+    static tolua_t tolua_element(ElementType type) {
+        switch (type) {
+        case ElementType::I1: return tolua_narrow<int8_t>;
+        case ElementType::U1: return tolua_narrow<uint8_t>;
+        case ElementType::I2: return tolua_narrow<int16_t>;
+        case ElementType::U2: return tolua_narrow<uint16_t>;
+        case ElementType::I4: return tolua_narrow<int32_t>;
+        case ElementType::U4: return tolua_narrow<uint32_t>;
+        default: return tolua_integer;
+        }
+    }
 
-    static tolua_t tolua(lua_State* L, const win32::cache* cache, TypeSig type) {
-        assert(type.ptr_count() == 0);
+    static tolua_t tolua(const win32::cache* cache, TypeSig type) {
+        if (type.ptr_count() > 0 || is_interface(cache, type)) {
+            return tolua_integer;
+        }
         switch (type.element_type()) {
         case ElementType::Void:
             return tolua_void;
         case ElementType::ValueType: {
             auto& type_index = std::get<coded_index<TypeDefOrRef>>(type.Type());
-            auto def = resolve_type(*cache, type_index);
-            auto name = def.TypeName();
-            if (def.is_enum()) {
-                auto const& enum_def = def.get_enum_definition();
-                switch (enum_def.m_underlying_type) {
-                case ElementType::I1:
-                case ElementType::U1:
-                case ElementType::I2:
-                case ElementType::U2:
-                case ElementType::I4:
-                case ElementType::U4:
-                case ElementType::I8:
-                case ElementType::U8:
-                case ElementType::U:
-                case ElementType::I:
-                    return tolua_integer;
-                default:
-                    break;
-                }
-                luaL_error(L, "#RET Unrecognized %s encountered.", name.data());
-                return tolua_invalid;
+            auto def = cache->resolve(type_index);
+            if (cache->is_enum(def) && is_integer(cache->underlying_type(def))) {
+                return tolua_element(cache->underlying_type(def));
             }
-            auto it = ToLua.find(name);
-            if (it == ToLua.end()) {
-                luaL_error(L, "#RET Unrecognized %s encountered.", name.data());
-                return tolua_invalid;
+            switch (cache->typedef_kind(def)) {
+            case native_typedef::integer:
+                return tolua_element(cache->underlying_type(def));
+            case native_typedef::boolean:
+                return tolua_boolean;
+            case native_typedef::pointer:
+            case native_typedef::string:
+                return tolua_integer;
+            default:
+                break;
             }
-            return it->second;
+            if (cache->type_category(def) == category::struct_type) {
+                uint32_t size = cache->struct_layout(def).size;
+                if (struct_in_register(size) && size <= sizeof(uintptr_t)) {
+                    return [plan = result_plan(cache, def), size](lua_State* L, uintptr_t v) {
+                        memcpy(new_struct(L, plan, size), &v, size);
+                        return 1;
+                    };
+                }
+            }
+            cache::throw_invalid("#RET Unrecognized ", def.TypeName(), " encountered.");
         }
         case ElementType::I1:
         case ElementType::U1:
@@ -209,7 +339,7 @@ namespace win32 {
         case ElementType::U8:
         case ElementType::U:
         case ElementType::I:
-            return tolua_integer;
+            return tolua_element(type.element_type());
         case ElementType::Boolean:
             return tolua_boolean;
         case ElementType::Char:
@@ -222,27 +352,1132 @@ namespace win32 {
         case ElementType::Var:
         case ElementType::MVar:
         default:
-            luaL_error(L, "#RET Unrecognized ELEMENT_TYPE encountered.");
-            return tolua_invalid;
+            cache::throw_invalid("#RET Unrecognized ELEMENT_TYPE encountered.");
         }
     }
 
-    template <typename>
-    struct function_type_;
-    template <size_t ...Is>
-    struct function_type_<std::index_sequence<Is...>> {
-        using type = uintptr_t (__stdcall *)(decltype(Is, uintptr_t())...);
+    // Pointer parameter described by NativeArrayInfoAttribute. A Lua table passed there is
+    // converted into a native array on the Lua stack, and copied back into the table for [Out] arrays.
+    struct array_param {
+        enum class element : uint8_t { i8, u8, i16, u16, i32, u32, i64, u64, f32, f64, pointer };
+        size_t index;
+        size_t count_index = (size_t)-1; // parameter receiving the element count
+        bool count_auto = false;         // count parameter is an integer filled from the table length
+        bool count_out = false;          // count parameter points to the number of elements written
+        uint32_t count_const = 0;
+        element type;
+        bool out = false;
+        int lua_base = 1;                // Lua index of the first parameter
+
+        static size_t element_size(element type) {
+            switch (type) {
+            case element::i8:
+            case element::u8:
+                return 1;
+            case element::i16:
+            case element::u16:
+                return 2;
+            case element::i32:
+            case element::u32:
+            case element::f32:
+                return 4;
+            case element::pointer:
+                return sizeof(void*);
+            default:
+                return 8;
+            }
+        }
+
+        static void write_element(lua_State* L, int idx, element type, uint8_t* p) {
+            switch (type) {
+            case element::f32: {
+                float v = (float)luaL_checknumber(L, idx);
+                memcpy(p, &v, sizeof(v));
+                break;
+            }
+            case element::f64: {
+                double v = luaL_checknumber(L, idx);
+                memcpy(p, &v, sizeof(v));
+                break;
+            }
+            case element::pointer: {
+                uintptr_t v;
+                switch (lua_type(L, idx)) {
+                case LUA_TNIL:
+                    v = 0;
+                    break;
+                case LUA_TLIGHTUSERDATA:
+                    v = (uintptr_t)lua_touserdata(L, idx);
+                    break;
+                case LUA_TUSERDATA:
+                    v = (uintptr_t)userdata_pointer(L, idx);
+                    break;
+                case LUA_TSTRING:
+                    // Array parameters only: the table holds the string for the duration of the call.
+                    v = (uintptr_t)lua_tostring(L, idx);
+                    break;
+                default:
+                    v = (uintptr_t)luaL_checkinteger(L, idx);
+                    break;
+                }
+                memcpy(p, &v, sizeof(v));
+                break;
+            }
+            default: {
+                // Little endian: the low bytes of the integer are the element.
+                lua_Integer v = lua_isboolean(L, idx) ? lua_toboolean(L, idx) : luaL_checkinteger(L, idx);
+                memcpy(p, &v, element_size(type));
+                break;
+            }
+            }
+        }
+
+        static void push_element(lua_State* L, element type, uint8_t const* p) {
+            auto load = [&](auto v) {
+                memcpy(&v, p, sizeof(v));
+                return v;
+            };
+            switch (type) {
+            case element::i8:      lua_pushinteger(L, load(int8_t())); break;
+            case element::u8:      lua_pushinteger(L, load(uint8_t())); break;
+            case element::i16:     lua_pushinteger(L, load(int16_t())); break;
+            case element::u16:     lua_pushinteger(L, load(uint16_t())); break;
+            case element::i32:     lua_pushinteger(L, load(int32_t())); break;
+            case element::u32:     lua_pushinteger(L, load(uint32_t())); break;
+            case element::i64:     lua_pushinteger(L, load(int64_t())); break;
+            case element::u64:     lua_pushinteger(L, (lua_Integer)load(uint64_t())); break;
+            case element::f32:     lua_pushnumber(L, load(float())); break;
+            case element::f64:     lua_pushnumber(L, load(double())); break;
+            case element::pointer: lua_pushinteger(L, (lua_Integer)load(uintptr_t())); break;
+            }
+        }
+
+        // Returns the number of elements allocated, 0 when the argument is not a table.
+        size_t marshal(lua_State* L, uintptr_t* args) const {
+            int idx = (int)index + lua_base;
+            if (lua_type(L, idx) != LUA_TTABLE) {
+                return 0;
+            }
+            size_t len = (size_t)lua_rawlen(L, idx);
+            size_t n = len;
+            if (count_const) {
+                if (len > count_const) {
+                    luaL_error(L, "#%d expects at most %d elements", idx, (int)count_const);
+                }
+                n = count_const;
+            }
+            size_t size = element_size(type);
+            if (!count_const && count_auto && !lua_isnoneornil(L, (int)count_index + lua_base)) {
+                // The callee reads or writes that many elements. Input arrays must hold them all,
+                // an explicit count sizes the buffer of an out array.
+                int count_idx = (int)count_index + lua_base;
+                lua_Integer count = (lua_Integer)(intptr_t)args[count_index];
+                luaL_argcheck(L, count >= 0, count_idx, "negative count");
+                if (!out) {
+                    luaL_argcheck(L, (size_t)count <= len, count_idx, "count exceeds the array length");
+                }
+                else if ((uint64_t)count > PTRDIFF_MAX / size) {
+                    luaL_argerror(L, count_idx, "count too large");
+                }
+                n = std::max(n, (size_t)count);
+            }
+            auto p = (uint8_t*)lua_newuserdatauv(L, n ? n * size : 1, 0);
+            memset(p, 0, n * size);
+            for (size_t i = 0; i < len; ++i) {
+                lua_rawgeti(L, idx, (lua_Integer)i + 1);
+                write_element(L, -1, type, p + i * size);
+                lua_pop(L, 1);
+            }
+            args[index] = (uintptr_t)p;
+            if (count_auto && lua_isnoneornil(L, (int)count_index + lua_base)) {
+                args[count_index] = n;
+            }
+            return n;
+        }
+
+        void unmarshal(lua_State* L, uintptr_t const* args, size_t n) const {
+            if (!out || n == 0) {
+                return;
+            }
+            if (count_out && args[count_index]) {
+                n = std::min(n, (size_t)*(uint32_t const*)args[count_index]);
+            }
+            int idx = (int)index + lua_base;
+            size_t size = element_size(type);
+            auto p = (uint8_t const*)args[index];
+            for (size_t i = 0; i < n; ++i) {
+                push_element(L, type, p + i * size);
+                lua_rawseti(L, idx, (lua_Integer)i + 1);
+            }
+        }
+    };
+
+    fromlua_t fromlua_array = [](lua_State* L, int idx)->uintptr_t {
+        if (lua_type(L, idx) == LUA_TTABLE) {
+            return 0; // filled by array_param::marshal
+        }
+        return fromlua_pointer(L, idx);
     };
-    template <size_t N>
-    using function_type = typename function_type_<std::make_index_sequence<N>>::type;
+    fromlua_t fromlua_count = [](lua_State* L, int idx)->uintptr_t {
+        return (uintptr_t)luaL_optinteger(L, idx, 0);
+    };
+
+    // Element stored at a location of the given type, or at what it points to when deref is set.
+    static std::optional<array_param::element> scalar_element(const win32::cache* cache, TypeSig const& type, bool deref = false) {
+        using element = array_param::element;
+        if (type.ptr_count() > (deref ? 1 : 0)) {
+            return element::pointer;
+        }
+        constexpr bool x64 = sizeof(void*) == 8;
+        auto from_element_type = [&](ElementType t) -> std::optional<element> {
+            switch (t) {
+            case ElementType::Boolean:
+            case ElementType::U1: return element::u8;
+            case ElementType::I1: return element::i8;
+            case ElementType::I2: return element::i16;
+            case ElementType::Char:
+            case ElementType::U2: return element::u16;
+            case ElementType::I4: return element::i32;
+            case ElementType::U4: return element::u32;
+            case ElementType::I8: return element::i64;
+            case ElementType::U8: return element::u64;
+            case ElementType::I:  return x64 ? element::i64 : element::i32;
+            case ElementType::U:  return x64 ? element::u64 : element::u32;
+            case ElementType::R4: return element::f32;
+            case ElementType::R8: return element::f64;
+            default: return {};
+            }
+        };
+        if (type.element_type() != ElementType::ValueType) {
+            return from_element_type(type.element_type());
+        }
+        auto def = cache->resolve(std::get<coded_index<TypeDefOrRef>>(type.Type()));
+        if (cache->is_enum(def)) {
+            return from_element_type(cache->underlying_type(def));
+        }
+        switch (cache->typedef_kind(def)) {
+        case native_typedef::integer:
+        case native_typedef::boolean:
+            return from_element_type(cache->underlying_type(def));
+        case native_typedef::pointer:
+        case native_typedef::string:
+            return element::pointer;
+        default:
+            return {};
+        }
+    }
+
+    static std::optional<array_param> array_info(const win32::cache* cache, Param const& param, TypeSig const& type, size_t index) {
+        auto attribute = cache->find_attribute(param, attribute_id::NativeArrayInfo);
+        if (!attribute) {
+            return {};
+        }
+        array_param r {};
+        r.index = index;
+        r.out = param.Flags().Out();
+        if (auto element = scalar_element(cache, type, true)) {
+            r.type = *element;
+        }
+        else {
+            return {}; // structs stay raw pointers
+        }
+        for (auto const& arg : cache->attribute_value(attribute).NamedArgs()) {
+            auto const* value = std::get_if<ElemSig>(&arg.value.value);
+            if (!value) {
+                continue;
+            }
+            int64_t v = std::visit([](auto&& v) -> int64_t {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_integral_v<T>) {
+                    return (int64_t)v;
+                }
+                else {
+                    return -1;
+                }
+            }, value->value);
+            if (arg.name == "CountConst" && v > 0) {
+                r.count_const = (uint32_t)v;
+            }
+            else if (arg.name == "CountParamIndex" && v >= 0) {
+                r.count_index = (size_t)v;
+            }
+        }
+        return r;
+    }
+
+    // Invoke signature of a delegate type: native arguments to Lua, and the Lua result back.
+    struct callback_plan {
+        std::vector<tolua_t> params_f;
+        std::optional<array_param::element> result;
+    };
+
+    // A Lua function bound to a native entry point. The win32::callback userdata points to it; the
+    // thunk slot and every queued call hold a reference, so it outlives the last native caller.
+    struct callback {
+        callback_plan const* plan;
+        lua_State* L;
+        int function_ref = LUA_NOREF;
+        int thread_ref = LUA_NOREF;
+        void* entry = nullptr;
+        std::shared_ptr<call_queue> queue; // set for queued and blocking callbacks
+        bool wait = false;
+        bool closed = false; // owner thread only: its queued calls are completed without running
+        std::atomic<int> refs { 1 };
+
+        callback(callback_plan const* plan, lua_State* L)
+            : plan(plan), L(L)
+        { }
+
+        void retain() noexcept {
+            refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void release() noexcept {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+    };
+
+    // Runs on whichever thread makes the last call through a released entry.
+    static void callback_retire(void* context) {
+        ((callback*)context)->release();
+    }
+
+    static void discard_call(pending_call* call) {
+        ((callback*)call->target)->release();
+        delete call;
+    }
+
+    static uintptr_t callback_result(lua_State* L, int idx) {
+        switch (lua_type(L, idx)) {
+        case LUA_TNONE:
+        case LUA_TNIL:
+            return 0;
+        case LUA_TBOOLEAN:
+            return lua_toboolean(L, idx) ? 1 : 0;
+        case LUA_TLIGHTUSERDATA:
+        case LUA_TUSERDATA:
+            return (uintptr_t)lua_touserdata(L, idx);
+        default:
+            return (uintptr_t)luaL_checkinteger(L, idx);
+        }
+    }
+
+    static int callback_call(lua_State* L) {
+        auto const& cb = *(callback const*)lua_touserdata(L, 1);
+        auto args = (uintptr_t const*)lua_touserdata(L, 2);
+        auto r = (uintptr_t*)lua_touserdata(L, 3);
+        auto const& params = cb.plan->params_f;
+        luaL_checkstack(L, (int)params.size() + 1, nullptr);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, cb.function_ref);
+        for (size_t i = 0; i < params.size(); ++i) {
+            params[i](L, args[i]);
+        }
+        lua_call(L, (int)params.size(), cb.plan->result ? 1 : 0);
+        if (cb.plan->result) {
+            *r = callback_result(L, -1);
+        }
+        return 0;
+    }
+
+    // Pops the error object of a failed callback and hands it to the handler set with
+    // win32.callback_error. Without one, or when the handler fails too, it becomes a warning of L.
+    static void report_callback_error(lua_State* L) {
+        if (lua_checkstack(L, 2)) {
+            if (lua_getfield(L, LUA_REGISTRYINDEX, "win32::callback_error") == LUA_TFUNCTION) {
+                lua_insert(L, -2);
+                if (lua_pcall(L, 1, 0, 0) == LUA_OK) {
+                    return;
+                }
+            }
+            else {
+                lua_pop(L, 1);
+            }
+        }
+        auto msg = lua_tostring(L, -1);
+        lua_warning(L, "win32 callback: ", 1);
+        lua_warning(L, msg ? msg : "error object is not a string", 0);
+        lua_pop(L, 1);
+    }
+
+    // Errors can't unwind through the native frames that called us: report them and return 0.
+    static uintptr_t run_callback(lua_State* L, callback const* cb, uintptr_t const* args) {
+        uintptr_t r = 0;
+        if (!lua_checkstack(L, 4)) {
+            lua_warning(L, "win32 callback: stack overflow", 0);
+            return 0;
+        }
+        lua_pushcfunction(L, callback_call);
+        lua_pushlightuserdata(L, (void*)cb);
+        lua_pushlightuserdata(L, (void*)args);
+        lua_pushlightuserdata(L, &r);
+        if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
+            report_callback_error(L);
+        }
+        return r;
+    }
 
-    template <bool hasR, size_t paramN>
-    struct caller {
-        function_type<paramN> f;
+    static uintptr_t callback_dispatch(void* context, uintptr_t const* args) {
+        auto cb = (callback const*)context;
+        return run_callback(cb->L, cb, args);
+    }
+
+    // The thunk slot keeps cb alive for the whole call, a posted call takes a reference of its own.
+    static uintptr_t callback_dispatch_queued(void* context, uintptr_t const* args) {
+        auto cb = (callback*)context;
+        auto& q = *cb->queue;
+        if (q.owner()) {
+            return callback_dispatch(context, args);
+        }
+        size_t n = cb->plan->params_f.size();
+        if (!cb->wait) {
+            auto call = new (std::nothrow) pending_call;
+            if (!call) {
+                return 0;
+            }
+            call->target = cb;
+            std::copy(args, args + n, call->args);
+            cb->retain();
+            if (!q.post(call)) {
+                discard_call(call);
+            }
+            return 0;
+        }
+        pending_call call;
+        call.target = cb;
+        std::copy(args, args + n, call.args);
+        q.send(call);
+        return call.result;
+    }
+
+    // The registry userdata shares the queue with the callbacks using it. Collecting it closes the
+    // queue, which waits for the producers still inside; later calls return 0 without queueing.
+    static int callback_queue_gc(lua_State* L) {
+        auto& q = *(std::shared_ptr<call_queue>*)lua_touserdata(L, 1);
+        if (q) {
+            q->close();
+        }
+        q.~shared_ptr<call_queue>();
+        return 0;
+    }
+
+    static std::shared_ptr<call_queue>* get_queue(lua_State* L, bool create) {
+        if (lua_getfield(L, LUA_REGISTRYINDEX, "win32::queue") != LUA_TNIL || !create) {
+            auto q = (std::shared_ptr<call_queue>*)lua_touserdata(L, -1);
+            lua_pop(L, 1);
+            return q;
+        }
+        lua_pop(L, 1);
+        auto q = new (lua_newuserdatauv(L, sizeof(std::shared_ptr<call_queue>), 0)) std::shared_ptr<call_queue>;
+        lua_newtable(L);
+        lua_pushcfunction(L, callback_queue_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, "win32::queue");
+        *q = std::make_shared<call_queue>(discard_call);
+        return q;
+    }
+
+    int dispatch_pending(lua_State* L, int max) {
+        auto q = get_queue(L, false);
+        if (!q || !*q) {
+            return 0;
+        }
+        int n = 0;
+        while (n < max) {
+            auto call = (*q)->pop();
+            if (!call) {
+                break;
+            }
+            // Errors are reported like those of a direct call, and the call is completed anyway.
+            auto cb = (callback*)call->target;
+            if (!cb->closed) {
+                call->result = run_callback(L, cb, call->args);
+            }
+            (*q)->complete(call);
+            ++n;
+        }
+        return n;
+    }
+
+    // Owner thread. Native code calling the entry from now on gets 0, and calls still queued for it
+    // are completed without running. cb itself goes away with the last reference to it.
+    static void callback_release(lua_State* L, callback*& cb) {
+        if (!cb) {
+            return;
+        }
+        cb->closed = true;
+        luaL_unref(L, LUA_REGISTRYINDEX, cb->function_ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, cb->thread_ref);
+        cb->function_ref = LUA_NOREF;
+        cb->thread_ref = LUA_NOREF;
+        if (cb->queue) {
+            auto target = cb;
+            cb->queue->drop_if([=](pending_call const& call) { return call.target == target; });
+        }
+        if (cb->entry) {
+            release_thunk(cb->plan->params_f.size(), cb->entry, callback_retire);
+        }
+        else {
+            cb->release();
+        }
+        cb = nullptr;
+    }
+
+    static int callback_gc(lua_State* L) {
+        callback_release(L, *(callback**)luaL_checkudata(L, 1, "win32::callback"));
+        return 0;
+    }
+
+    static tolua_t callback_param(const win32::cache* cache, TypeSig const& type) {
+        if (type.ptr_count() > 0 || is_interface(cache, type)) {
+            return [](lua_State* L, uintptr_t v) {
+                lua_pushlightuserdata(L, (void*)v);
+                return 1;
+            };
+        }
+        if (type.element_type() == ElementType::Boolean) {
+            return tolua_boolean;
+        }
+        auto element = scalar_element(cache, type);
+        if (!element || *element == array_param::element::f32 || *element == array_param::element::f64) {
+            cache::throw_invalid("Unsupported callback parameter.");
+        }
+        return [e = *element](lua_State* L, uintptr_t v) {
+            // Little endian: the element is in the low bytes of the register.
+            array_param::push_element(L, e, (uint8_t const*)&v);
+            return 1;
+        };
+    }
+
+    static MethodDef invoke_method(TypeDef const& delegate) {
+        for (auto&& method : delegate.MethodList()) {
+            if (method.Name() == "Invoke") {
+                return method;
+            }
+        }
+        cache::throw_invalid("Delegate ", delegate.TypeName(), " has no Invoke method.");
+    }
+
+    static std::unique_ptr<callback_plan> make_callback_plan(const win32::cache* cache, TypeDef const& delegate) {
+        auto sig = invoke_method(delegate).Signature();
+        if (sig.ParamCount() > thunk_max_params) {
+            cache::throw_invalid("Delegate ", delegate.TypeName(), " has too many parameters.");
+        }
+        auto plan = std::make_unique<callback_plan>();
+        for (auto&& param : sig.Params()) {
+            plan->params_f.push_back(callback_param(cache, param.Type()));
+        }
+        if (sig.ReturnType()) {
+            auto const& type = sig.ReturnType().Type();
+            auto element = type.ptr_count() > 0 ? array_param::element::pointer : scalar_element(cache, type);
+            if (!element && type.element_type() == ElementType::Boolean) {
+                element = array_param::element::u8;
+            }
+            if (!element || *element == array_param::element::f32 || *element == array_param::element::f64) {
+                cache::throw_invalid("Delegate ", delegate.TypeName(), " has an unsupported return type.");
+            }
+            plan->result = element;
+        }
+        return plan;
+    }
+
+    static lazy_map<uint32_t, std::unique_ptr<callback_plan>> callback_plans;
+
+    callback_plan const* compile_callback(win32::cache const* cache, TypeDef const& delegate) {
+        if (auto plan = callback_plans.find(delegate.index())) {
+            return plan->get();
+        }
+        return callback_plans.insert(delegate.index(), make_callback_plan(cache, delegate)).get();
+    }
+
+    struct struct_plan {
+        struct field {
+            std::string_view name;
+            uint32_t offset;
+            uint32_t size;
+            uint32_t count; // elements of a fixed array, 0 for a single value
+            array_param::element type;
+            struct_plan const* nested; // struct or union fields, nullptr for scalars
+            uint8_t shift;
+            uint64_t mask; // bitfields: the value is (field >> shift) & mask, 0 for other fields
+        };
+        uint32_t size;
+        std::vector<field> fields;  // bitfields after the plain fields, for pack and unpack
+        std::vector<field> members; // fields of anonymous structs and unions flattened, for struct userdata
+        std::vector<std::string_view> ambiguous; // names several flattened members have, not accessible by name
+    };
+
+    static lazy_map<uint32_t, std::unique_ptr<struct_plan>> struct_plans;
+
+    static std::unique_ptr<struct_plan> make_struct_plan(const win32::cache* cache, TypeDef const& type) {
+        auto const& layout = cache->struct_layout(type);
+        auto plan = std::make_unique<struct_plan>();
+        plan->size = layout.size;
+        for (auto const& f : layout.fields) {
+            auto sig = f.def.Signature().Type();
+            uint32_t count = 0;
+            if (sig.is_array()) {
+                count = 1;
+                for (auto n : sig.array_sizes()) {
+                    count *= n;
+                }
+            }
+            struct_plan::field field { f.def.Name(), f.offset, f.size, count, array_param::element::pointer, nullptr, 0, 0 };
+            if (sig.ptr_count() == 0 && sig.element_type() == ElementType::Class) {
+                field.type = array_param::element::pointer; // function pointer
+            }
+            else if (auto element = scalar_element(cache, sig)) {
+                field.type = *element;
+            }
+            else if (sig.element_type() == ElementType::ValueType) {
+                field.nested = compile_struct(cache, cache->resolve(std::get<coded_index<TypeDefOrRef>>(sig.Type())));
+            }
+            else {
+                cache::throw_invalid("Field ", type.TypeName(), ".", f.def.Name(), " has no Lua representation.");
+            }
+            plan->fields.push_back(field);
+        }
+        for (auto const& b : layout.bitfields) {
+            auto field = plan->fields[b.field];
+            if (field.nested || field.count || b.length == 0 || b.shift + b.length > 8 * field.size) {
+                cache::throw_invalid("Bitfield ", type.TypeName(), ".", b.name, " does not fit its field.");
+            }
+            field.name = b.name;
+            field.shift = (uint8_t)b.shift;
+            field.mask = b.length >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << b.length) - 1;
+            plan->fields.push_back(field);
+        }
+        // Members of an anonymous union share its offset, so they read as overlapping views of the same bytes.
+        for (auto const& field : plan->fields) {
+            if (!field.nested || field.count || field.name.substr(0, 9) != "Anonymous") {
+                plan->members.push_back(field);
+                continue;
+            }
+            for (auto member : field.nested->members) {
+                member.offset += field.offset;
+                plan->members.push_back(member);
+            }
+            plan->ambiguous.insert(plan->ambiguous.end(), field.nested->ambiguous.begin(), field.nested->ambiguous.end());
+        }
+        std::map<std::string_view, size_t> seen;
+        for (auto const& m : plan->members) {
+            if (++seen[m.name] == 2) {
+                plan->ambiguous.push_back(m.name);
+            }
+        }
+        return plan;
+    }
+
+    struct_plan const* compile_struct(win32::cache const* cache, TypeDef const& type) {
+        if (auto plan = struct_plans.find(type.index())) {
+            return plan->get();
+        }
+        return struct_plans.insert(type.index(), make_struct_plan(cache, type)).get();
+    }
+
+    size_t struct_size(struct_plan const* plan) {
+        return plan->size;
+    }
+
+    // Field names interned once per lua_State, in field order, kept in the registry under the plan address.
+    static int push_struct_keys(lua_State* L, struct_plan const* plan) {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, plan) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            lua_createtable(L, (int)plan->fields.size(), 0);
+            for (size_t i = 0; i < plan->fields.size(); ++i) {
+                auto name = plan->fields[i].name;
+                lua_pushlstring(L, name.data(), name.size());
+                lua_rawseti(L, -2, (lua_Integer)i + 1);
+            }
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, plan);
+        }
+        return lua_gettop(L);
+    }
+
+    // Bitfields of a signed type are sign extended from their top bit.
+    static uint64_t load_bits(struct_plan::field const& f, uint8_t const* p) {
+        uint64_t v = 0;
+        memcpy(&v, p, array_param::element_size(f.type));
+        v = (v >> f.shift) & f.mask;
+        switch (f.type) {
+        case array_param::element::i8:
+        case array_param::element::i16:
+        case array_param::element::i32:
+        case array_param::element::i64: {
+            uint64_t sign = (f.mask >> 1) + 1;
+            return (v ^ sign) - sign;
+        }
+        default:
+            return v;
+        }
+    }
+
+    static void store_bits(lua_State* L, struct_plan::field const& f, int idx, uint8_t* p) {
+        uint64_t bits = lua_isboolean(L, idx) ? lua_toboolean(L, idx) : (uint64_t)luaL_checkinteger(L, idx);
+        size_t size = array_param::element_size(f.type);
+        uint64_t v = 0;
+        memcpy(&v, p, size);
+        v = (v & ~(f.mask << f.shift)) | ((bits & f.mask) << f.shift);
+        memcpy(p, &v, size);
+    }
+
+    // User value 1 of win32.memory and win32.struct buffers is the table of the strings their pointer
+    // fields point into, keyed by field address. Pushes it and returns true when the buffer has one.
+    static bool push_anchors(lua_State* L, int buffer, bool create) {
+        if (!buffer) {
+            return false;
+        }
+        int t = lua_getiuservalue(L, buffer, 1);
+        if (t == LUA_TTABLE) {
+            return true;
+        }
+        lua_pop(L, 1);
+        if (t != LUA_TNIL || !create) {
+            return false;
+        }
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, buffer, 1);
+        return true;
+    }
+
+    // A buffer keeps the strings and userdata its pointer fields point into alive. Strings are only
+    // accepted with a buffer: nothing else would keep their bytes.
+    static void store_pointer(lua_State* L, struct_plan::field const& f, int idx, int buffer, uint8_t* p) {
+        int t = lua_type(L, idx);
+        if (t == LUA_TSTRING) {
+            auto v = (uintptr_t)lua_tostring(L, idx);
+            memcpy(p, &v, sizeof(v));
+        }
+        else {
+            array_param::write_element(L, idx, f.type, p);
+        }
+        bool anchored = t == LUA_TSTRING || t == LUA_TUSERDATA;
+        if (push_anchors(L, buffer, anchored)) {
+            if (anchored) {
+                lua_pushvalue(L, idx);
+            }
+            else {
+                lua_pushnil(L);
+            }
+            lua_rawsetp(L, -2, p);
+            lua_pop(L, 1);
+        }
+        else if (t == LUA_TSTRING) {
+            luaL_error(L, "%s: strings need a win32.memory or win32.struct buffer to keep them alive.", f.name.data());
+        }
+    }
+
+    static void pack_value(lua_State* L, struct_plan::field const& f, int idx, int buffer, uint8_t* p) {
+        if (f.nested) {
+            pack_struct(L, f.nested, idx, p, buffer);
+        }
+        else if (f.mask) {
+            store_bits(L, f, idx, p);
+        }
+        else if (f.type == array_param::element::pointer) {
+            store_pointer(L, f, idx, buffer, p);
+        }
+        else {
+            array_param::write_element(L, idx, f.type, p);
+        }
+    }
+
+    static void pack_field(lua_State* L, struct_plan::field const& f, int idx, int buffer, uint8_t* p) {
+        // Bytes of a whole struct or array are copied as one run.
+        int t = lua_type(L, idx);
+        if ((f.nested || f.count) && (t == LUA_TSTRING || t == LUA_TUSERDATA)) {
+            void const* src = t == LUA_TSTRING ? (void const*)lua_tostring(L, idx) : userdata_pointer(L, idx);
+            // A struct view (or other boxed pointer) has no length of its own: it stands for the whole field.
+            size_t len = t == LUA_TUSERDATA && src != lua_touserdata(L, idx) ? f.size : (size_t)lua_rawlen(L, idx);
+            memmove(p, src, std::min(len, (size_t)f.size));
+            return;
+        }
+        if (!f.count) {
+            pack_value(L, f, idx, buffer, p);
+            return;
+        }
+        luaL_checktype(L, idx, LUA_TTABLE);
+        uint32_t size = f.size / f.count;
+        uint32_t n = (uint32_t)std::min((lua_Unsigned)f.count, lua_rawlen(L, idx));
+        for (uint32_t i = 0; i < n; ++i) {
+            lua_rawgeti(L, idx, (lua_Integer)i + 1);
+            pack_value(L, f, lua_gettop(L), buffer, p + i * size);
+            lua_pop(L, 1);
+        }
+    }
+
+    void pack_struct(lua_State* L, struct_plan const* plan, int idx, void* dst, int buffer) {
+        idx = lua_absindex(L, idx);
+        if (buffer) {
+            buffer = lua_absindex(L, buffer);
+        }
+        if (lua_type(L, idx) == LUA_TSTRING) {
+            size_t len = 0;
+            auto str = lua_tolstring(L, idx, &len);
+            memcpy(dst, str, std::min(len, (size_t)plan->size));
+            return;
+        }
+        luaL_checktype(L, idx, LUA_TTABLE);
+        luaL_checkstack(L, 6, NULL);
+        int keys = push_struct_keys(L, plan);
+        for (size_t i = 0; i < plan->fields.size(); ++i) {
+            lua_rawgeti(L, keys, (lua_Integer)i + 1);
+            if (lua_rawget(L, idx) != LUA_TNIL) {
+                auto const& f = plan->fields[i];
+                pack_field(L, f, lua_gettop(L), buffer, (uint8_t*)dst + f.offset);
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+
+    static void unpack_value(lua_State* L, struct_plan::field const& f, uint8_t const* p) {
+        if (f.nested) {
+            unpack_struct(L, f.nested, p);
+        }
+        else if (f.mask) {
+            lua_pushinteger(L, (lua_Integer)load_bits(f, p));
+        }
+        else {
+            array_param::push_element(L, f.type, p);
+        }
+    }
+
+    void unpack_struct(lua_State* L, struct_plan const* plan, void const* src) {
+        luaL_checkstack(L, 4, NULL);
+        lua_createtable(L, 0, (int)plan->fields.size());
+        int t = lua_gettop(L);
+        int keys = push_struct_keys(L, plan);
+        for (size_t i = 0; i < plan->fields.size(); ++i) {
+            auto const& f = plan->fields[i];
+            auto p = (uint8_t const*)src + f.offset;
+            lua_rawgeti(L, keys, (lua_Integer)i + 1);
+            if (f.count) {
+                uint32_t size = f.size / f.count;
+                lua_createtable(L, (int)f.count, 0);
+                for (uint32_t j = 0; j < f.count; ++j) {
+                    unpack_value(L, f, p + j * size);
+                    lua_rawseti(L, -2, (lua_Integer)j + 1);
+                }
+            }
+            else {
+                unpack_value(L, f, p);
+            }
+            lua_rawset(L, t);
+        }
+        lua_pop(L, 1);
+    }
+
+    static struct_plan::field const& check_member(lua_State* L) {
+        lua_pushvalue(L, 2);
+        int t = lua_rawget(L, lua_upvalueindex(1));
+        if (t == LUA_TBOOLEAN) {
+            luaL_error(L, "%s is ambiguous: several anonymous members have this name.", luaL_tolstring(L, 2, NULL));
+        }
+        if (t != LUA_TLIGHTUSERDATA) {
+            luaL_error(L, "%s is not a field.", luaL_tolstring(L, 2, NULL));
+        }
+        auto const& m = *(struct_plan::field const*)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        return m;
+    }
+
+    // Bytes of the struct at index 1: its own, or those a view aliases (upvalue 2 is true in view metatables).
+    static uint8_t* struct_bytes(lua_State* L) {
+        void* p = lua_touserdata(L, 1);
+        return lua_toboolean(L, lua_upvalueindex(2)) ? *(uint8_t**)p : (uint8_t*)p;
+    }
+
+    // Stack index of the userdata owning those bytes, which holds the anchors of their pointer fields.
+    static int struct_owner(lua_State* L) {
+        if (!lua_toboolean(L, lua_upvalueindex(2))) {
+            return 1;
+        }
+        lua_getiuservalue(L, 1, 1);
+        return lua_gettop(L);
+    }
+
+    static void push_struct_metatable(lua_State* L, struct_plan const* plan, bool view);
+
+    // A nested struct member aliases the bytes of its parent: writes through it land in the parent,
+    // which the view keeps alive in user value 1.
+    static void push_struct_view(lua_State* L, struct_plan const* plan, uint8_t* p, int owner) {
+        owner = lua_absindex(L, owner);
+        *(uint8_t**)lua_newuserdatauv(L, sizeof(uint8_t*), 1) = p;
+        push_struct_metatable(L, plan, true);
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, owner);
+        lua_setiuservalue(L, -2, 1);
+    }
+
+    // Nested structs are returned as views; arrays as tables.
+    static int struct_get(lua_State* L) {
+        auto const& m = check_member(L);
+        auto p = struct_bytes(L) + m.offset;
+        if (m.count) {
+            uint32_t size = m.size / m.count;
+            lua_createtable(L, (int)m.count, 0);
+            for (uint32_t i = 0; i < m.count; ++i) {
+                unpack_value(L, m, p + i * size);
+                lua_rawseti(L, -2, (lua_Integer)i + 1);
+            }
+        }
+        else if (m.nested) {
+            push_struct_view(L, m.nested, p, struct_owner(L));
+        }
+        else if (m.mask) {
+            lua_pushinteger(L, (lua_Integer)load_bits(m, p));
+        }
+        else {
+            array_param::push_element(L, m.type, p);
+        }
+        return 1;
+    }
+
+    static int struct_set(lua_State* L) {
+        auto const& m = check_member(L);
+        auto p = struct_bytes(L) + m.offset;
+        pack_field(L, m, 3, struct_owner(L), p);
+        return 0;
+    }
+
+    static int struct_len(lua_State* L) {
+        auto plan = (struct_plan const*)lua_touserdata(L, lua_upvalueindex(1));
+        lua_pushinteger(L, (lua_Integer)plan->size);
+        return 1;
+    }
+
+    // One metatable per struct type and lua_State, and one for views of it. Its accessors map member
+    // names straight to the compiled field, so reading a member is one table lookup and one load.
+    static void push_struct_metatable(lua_State* L, struct_plan const* plan, bool view) {
+        luaL_getsubtable(L, LUA_REGISTRYINDEX, view ? "win32::struct_views" : "win32::structs");
+        if (lua_rawgetp(L, -1, plan) == LUA_TTABLE) {
+            lua_remove(L, -2);
+            return;
+        }
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 5);
+        lua_pushstring(L, "win32::struct");
+        lua_setfield(L, -2, "__name");
+        if (view) {
+            lua_pushboolean(L, 1);
+            lua_rawsetp(L, -2, &boxed_pointer_key);
+        }
+        lua_pushlightuserdata(L, (void*)plan);
+        lua_pushcclosure(L, struct_len, 1);
+        lua_setfield(L, -2, "__len");
+        lua_createtable(L, 0, (int)plan->members.size());
+        for (auto const& m : plan->members) {
+            lua_pushlstring(L, m.name.data(), m.name.size());
+            lua_pushlightuserdata(L, (void*)&m);
+            lua_rawset(L, -3);
+        }
+        for (auto const& name : plan->ambiguous) {
+            lua_pushlstring(L, name.data(), name.size());
+            lua_pushboolean(L, 0);
+            lua_rawset(L, -3);
+        }
+        lua_pushvalue(L, -1);
+        lua_pushboolean(L, view);
+        lua_pushcclosure(L, struct_get, 2);
+        lua_setfield(L, -3, "__index");
+        lua_pushboolean(L, view);
+        lua_pushcclosure(L, struct_set, 2);
+        lua_setfield(L, -2, "__newindex");
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, -3, plan);
+        lua_remove(L, -2);
+    }
+
+    void* push_struct(lua_State* L, struct_plan const* plan) {
+        void* p = lua_newuserdatauv(L, plan->size, 1);
+        memset(p, 0, plan->size);
+        push_struct_metatable(L, plan, false);
+        lua_setmetatable(L, -2);
+        return p;
+    }
+
+    // Persistent callbacks get a thread of their own, so they can be entered while
+    // the creating coroutine is suspended; per-call callbacks run on the caller.
+    static void* new_callback(lua_State* L, callback_plan const* plan, int idx, bool own_thread, callback_mode mode = callback_mode::direct) {
+        idx = lua_absindex(L, idx);
+        auto& box = *(callback**)lua_newuserdatauv(L, sizeof(callback*), 0);
+        box = nullptr;
+        if (luaL_newmetatable(L, "win32::callback")) {
+            luaL_Reg l[] = {
+                { "__gc", callback_gc },
+                { "__close", callback_gc },
+                { NULL, NULL },
+            };
+            luaL_setfuncs(L, l, 0);
+        }
+        lua_setmetatable(L, -2);
+        auto cb = box = new callback(plan, L);
+        cb->wait = mode == callback_mode::blocking;
+        if (own_thread) {
+            cb->L = lua_newthread(L);
+            cb->thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+        lua_pushvalue(L, idx);
+        cb->function_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        auto dispatch = callback_dispatch;
+        if (mode != callback_mode::direct) {
+            cb->queue = *get_queue(L, true);
+            dispatch = callback_dispatch_queued;
+        }
+        cb->entry = acquire_thunk(plan->params_f.size(), dispatch, cb);
+        if (!cb->entry) {
+            luaL_error(L, "win32 callback pool exhausted (%d per signature size).", (int)thunk_pool_size);
+        }
+        return cb->entry;
+    }
+
+    void* push_callback(lua_State* L, callback_plan const* plan, int idx, callback_mode mode) {
+        return new_callback(L, plan, idx, true, mode);
+    }
+
+    // Delegate parameter. A Lua function passed there is bound to a thunk for the duration of the call.
+    struct delegate_param {
+        size_t index;
+        int lua_base;
+        callback_plan const* plan;
+
+        // Returns the stack index of the temporary callback, 0 when none was needed.
+        int marshal(lua_State* L, uintptr_t* args) const {
+            int idx = (int)index + lua_base;
+            if (lua_type(L, idx) == LUA_TFUNCTION) {
+                args[index] = (uintptr_t)new_callback(L, plan, idx, false);
+                return lua_gettop(L);
+            }
+            if (auto box = (callback**)luaL_testudata(L, idx, "win32::callback")) {
+                if (*box && (*box)->plan != plan) {
+                    luaL_error(L, "#%d callback signature mismatch.", idx);
+                }
+            }
+            return 0;
+        }
+
+        static void unmarshal(lua_State* L, int slot) {
+            if (slot) {
+                callback_release(L, *(callback**)lua_touserdata(L, slot));
+            }
+        }
+    };
+
+    fromlua_t fromlua_delegate = [](lua_State* L, int idx)->uintptr_t {
+        switch (lua_type(L, idx)) {
+        case LUA_TFUNCTION:
+            return 0; // filled by delegate_param::marshal
+        case LUA_TUSERDATA:
+            if (auto box = (callback**)luaL_testudata(L, idx, "win32::callback")) {
+                return *box ? (uintptr_t)(*box)->entry : 0;
+            }
+            break;
+        default:
+            break;
+        }
+        return fromlua_pointer(L, idx);
+    };
+
+    static TypeDef delegate_type(const win32::cache* cache, TypeSig const& type) {
+        if (type.ptr_count() > 0) {
+            return {};
+        }
+        if (type.element_type() != ElementType::Class && type.element_type() != ElementType::ValueType) {
+            return {};
+        }
+        auto def = cache->resolve(std::get<coded_index<TypeDefOrRef>>(type.Type()));
+        return cache->type_category(def) == category::delegate_type ? def : TypeDef{};
+    }
+
+    // Native `this` of a method call: an interface userdata of the expected type or a raw pointer.
+    static uintptr_t check_self(lua_State* L) {
+        uintptr_t self = 0;
+        switch (lua_type(L, 1)) {
+        case LUA_TUSERDATA:
+            if (lua_getmetatable(L, 1)) {
+                bool same = lua_rawequal(L, -1, lua_upvalueindex(2));
+                lua_pop(L, 1);
+                if (same) {
+                    self = (uintptr_t)((interface_object const*)lua_touserdata(L, 1))->ptr;
+                    break;
+                }
+            }
+            luaL_typeerror(L, 1, "interface");
+            break;
+        case LUA_TLIGHTUSERDATA:
+            self = (uintptr_t)lua_touserdata(L, 1);
+            break;
+        default:
+            luaL_typeerror(L, 1, "interface");
+            break;
+        }
+        if (!self) {
+            luaL_error(L, "null interface pointer");
+        }
+        return self;
+    }
+
+    // Where a plan finds the native function.
+    enum class call_target {
+        address, // target is the function address
+        vtable,  // target is a vtable slot of the interface passed first, which is also the first native argument
+        pointer, // the function address is upvalue 2, so one plan serves every pointer of a delegate type
+    };
+
+    // Size of a struct result returned through a hidden pointer, 0 for results returned in a register.
+    static uint32_t hidden_result_size(win32::cache const* cache, RetTypeSig const& ret, call_target kind) {
+        auto const& type = ret.Type();
+        if (ret.ByRef() || type.ptr_count() > 0 || type.element_type() != ElementType::ValueType) {
+            return 0;
+        }
+        auto def = cache->resolve(std::get<coded_index<TypeDefOrRef>>(type.Type()));
+        if (cache->type_category(def) != category::struct_type || cache->typedef_kind(def) != native_typedef::none) {
+            return 0;
+        }
+        uint32_t size = cache->struct_layout(def).size;
+        if (kind == call_target::vtable) {
+            return size;
+        }
+        if (struct_in_register(size) && size <= sizeof(uintptr_t)) {
+            return 0;
+        }
+        // x86 returns 8 byte structs in EDX:EAX, which a register-sized result can't express.
+        if (sizeof(void*) == 4 && size == 8) {
+            cache::throw_invalid("#RET ", def.TypeName(), " can't be returned by value on this platform.");
+        }
+        return size;
+    }
+
+    enum class result_kind {
+        none,
+        value,  // returned in a register, converted by return_f
+        // Struct written through a pointer passed before the parameters (after `this` for methods).
+        // Functions use it for structs that don't fit a register; MSVC instance methods, which COM
+        // methods are, use it for every struct result that isn't a NativeTypedef, whatever its size.
+        hidden,
+    };
+
+    template <result_kind R, size_t paramN, call_target kind = call_target::address>
+    struct caller : public caller_plan {
+        static constexpr bool method = kind == call_target::vtable;
+        static constexpr bool hidden = R == result_kind::hidden;
+        using native_type = function_type<paramN + (method ? 1 : 0) + (hidden ? 1 : 0)>;
+        static constexpr int base = method ? 2 : 1; // Lua index of the first parameter
+        uintptr_t target;
         std::array<fromlua_t, paramN> params_f;
+        std::vector<array_param> arrays;
+        std::vector<delegate_param> delegates;
         tolua_t return_f;
-        caller(uintptr_t f_)
-            : f(reinterpret_cast<function_type<paramN>>(f_))
+        uint32_t result_size = 0; // hidden results
+        struct_plan const* result_struct = nullptr;
+        caller(uintptr_t target)
+            : caller_plan(s_call)
+            , target(target)
             , params_f()
             , return_f()
         {}
@@ -252,72 +1487,190 @@ namespace win32 {
         void set_return(tolua_t f) {
             return_f = f;
         }
-        template <size_t ...Is>
-        int call_impl(lua_State* L, std::index_sequence<Is...>) const {
-            if constexpr (hasR) {
-                uintptr_t r = f(params_f[Is](L, Is+1)...);
+        template <typename ...Args>
+        uintptr_t invoke(lua_State* L, Args... args) const {
+            if constexpr (method) {
+                uintptr_t self = check_self(L);
+                auto vtable = *(native_type const* const*)self;
+                return vtable[target](self, args...);
+            }
+            else if constexpr (kind == call_target::pointer) {
+                return reinterpret_cast<native_type>(lua_touserdata(L, lua_upvalueindex(2)))(args...);
+            }
+            else {
+                return reinterpret_cast<native_type>(target)(args...);
+            }
+        }
+        // The result buffer is allocated before the call, so the callee writes the struct in place.
+        template <typename ...Args>
+        uintptr_t call_native(lua_State* L, int result, Args... args) const {
+            if constexpr (hidden) {
+                return invoke(L, (uintptr_t)lua_touserdata(L, result), args...);
+            }
+            else {
+                (void)result;
+                return invoke(L, args...);
+            }
+        }
+        int push_result(lua_State* L, int result, uintptr_t r) const {
+            if constexpr (R == result_kind::value) {
                 return return_f(L, r);
             }
+            else if constexpr (hidden) {
+                lua_pushvalue(L, result);
+                return 1;
+            }
             else {
-                f(params_f[Is](L, Is+1)...);
+                (void)result;
+                (void)r;
                 return 0;
             }
         }
+        template <size_t ...Is>
+        int call_impl(lua_State* L, std::index_sequence<Is...>) const {
+            int result = 0;
+            if constexpr (hidden) {
+                new_struct(L, result_struct, result_size);
+                result = lua_gettop(L);
+            }
+            if (arrays.empty() && delegates.empty()) {
+                uintptr_t r = call_native(L, result, params_f[Is](L, (int)Is + base)...);
+                return push_result(L, result, r);
+            }
+            std::array<uintptr_t, paramN> args {};
+            ((args[Is] = params_f[Is](L, (int)Is + base)), ...);
+            std::array<size_t, paramN> counts {};
+            for (size_t i = 0; i < arrays.size(); ++i) {
+                counts[i] = arrays[i].marshal(L, args.data());
+            }
+            std::array<int, paramN> callbacks {};
+            for (size_t i = 0; i < delegates.size(); ++i) {
+                callbacks[i] = delegates[i].marshal(L, args.data());
+            }
+            uintptr_t r = call_native(L, result, args[Is]...);
+            for (size_t i = 0; i < delegates.size(); ++i) {
+                delegate_param::unmarshal(L, callbacks[i]);
+            }
+            for (size_t i = 0; i < arrays.size(); ++i) {
+                arrays[i].unmarshal(L, args.data(), counts[i]);
+            }
+            return push_result(L, result, r);
+        }
         static int s_call(lua_State* L) {
-            caller& c = *(caller*)lua_touserdata(L, lua_upvalueindex(1));
+            caller const& c = static_cast<caller const&>(*(caller_plan const*)lua_touserdata(L, lua_upvalueindex(1)));
             return c.call_impl(L, std::make_index_sequence<paramN>());
         }
-        static void create(lua_State* L, uintptr_t f, win32::cache const* cache, winmd::reader::MethodDef const& method) {
-            caller* c = (caller*)lua_newuserdatauv(L, sizeof(caller), 0);
-            new (c) caller{f};
-            auto sig = method.Signature();
+        static std::unique_ptr<caller_plan> create(uintptr_t target, win32::cache const* cache, winmd::reader::MethodDef const& method_def) {
+            auto c = std::make_unique<caller>(target);
+            auto sig = method_def.Signature();
             auto params_sig = sig.Params();
-            auto params_lst = method.ParamList();
+            auto params_lst = method_def.ParamList();
             for (size_t i = 0; i < paramN; ++i) {
                 auto const& param = *(params_lst.first + (int32_t)i);
                 auto const& paramSig = *(params_sig.first + i);
-                auto f = fromlua(L, cache, paramSig.Type(), param.Flags(), (int)i+1);
+                if (auto delegate = delegate_type(cache, paramSig.Type())) {
+                    c->set_param(i, fromlua_delegate);
+                    c->delegates.push_back({ i, base, compile_callback(cache, delegate) });
+                    continue;
+                }
+                if (paramSig.ByRef()) {
+                    c->set_param(i, fromlua_pointer);
+                    continue;
+                }
+                auto f = fromlua(cache, paramSig.Type(), param.Flags(), (int)i + base);
                 c->set_param(i, f);
+                if (paramSig.Type().ptr_count() > 0) {
+                    if (auto array = array_info(cache, param, paramSig.Type(), i)) {
+                        array->lua_base = base;
+                        c->set_param(i, fromlua_array);
+                        c->arrays.push_back(*array);
+                    }
+                }
+            }
+            for (auto& array : c->arrays) {
+                if (array.count_index >= paramN || array.count_const) {
+                    array.count_index = (size_t)-1;
+                    continue;
+                }
+                auto const& count_type = (params_sig.first + array.count_index)->Type();
+                auto element = scalar_element(cache, count_type);
+                if (count_type.ptr_count() == 0 && element && *element < array_param::element::f32) {
+                    array.count_auto = true;
+                    c->set_param(array.count_index, fromlua_count);
+                }
+                else if (count_type.ptr_count() == 1) {
+                    auto pointee = scalar_element(cache, count_type, true);
+                    array.count_out = pointee && (*pointee == array_param::element::u32 || *pointee == array_param::element::i32);
+                }
+            }
+            if constexpr (R == result_kind::value) {
+                auto const& ret = sig.ReturnType();
+                c->set_return(ret.ByRef() ? tolua_integer : tolua(cache, ret.Type()));
             }
-            if constexpr (hasR) {
-                auto f = tolua(L, cache, sig.ReturnType().Type());
-                c->set_return(f);
+            else if constexpr (hidden) {
+                c->result_size = hidden_result_size(cache, sig.ReturnType(), kind);
+                c->result_struct = result_plan(cache, cache->resolve(std::get<coded_index<TypeDefOrRef>>(sig.ReturnType().Type().Type())));
             }
-            lua_pushcclosure(L, s_call, 1);
+            return c;
         }
     };
 
-    bool create_caller(lua_State* L, uintptr_t f, win32::cache const* cache, winmd::reader::MethodDef const& method) {
-        auto sig = method.Signature();
-        if (sig.ReturnType()) {
-            switch (sig.ParamCount()) {
-            case 0: caller<true, 0>::create(L, f, cache, method); return true;
-            case 1: caller<true, 1>::create(L, f, cache, method); return true;
-            case 2: caller<true, 2>::create(L, f, cache, method); return true;
-            case 3: caller<true, 3>::create(L, f, cache, method); return true;
-            case 4: caller<true, 4>::create(L, f, cache, method); return true;
-            case 5: caller<true, 5>::create(L, f, cache, method); return true;
-            case 6: caller<true, 6>::create(L, f, cache, method); return true;
-            case 7: caller<true, 7>::create(L, f, cache, method); return true;
-            case 8: caller<true, 8>::create(L, f, cache, method); return true;
-            case 9: caller<true, 9>::create(L, f, cache, method); return true;
-            default: return false;
-            }
+    template <result_kind R, call_target kind>
+    static std::unique_ptr<caller_plan> compile_params(uintptr_t target, win32::cache const* cache, winmd::reader::MethodDef const& method_def) {
+        switch (method_def.Signature().ParamCount()) {
+        case 0: return caller<R, 0, kind>::create(target, cache, method_def);
+        case 1: return caller<R, 1, kind>::create(target, cache, method_def);
+        case 2: return caller<R, 2, kind>::create(target, cache, method_def);
+        case 3: return caller<R, 3, kind>::create(target, cache, method_def);
+        case 4: return caller<R, 4, kind>::create(target, cache, method_def);
+        case 5: return caller<R, 5, kind>::create(target, cache, method_def);
+        case 6: return caller<R, 6, kind>::create(target, cache, method_def);
+        case 7: return caller<R, 7, kind>::create(target, cache, method_def);
+        case 8: return caller<R, 8, kind>::create(target, cache, method_def);
+        case 9: return caller<R, 9, kind>::create(target, cache, method_def);
+        default: return nullptr;
         }
-        else {
-            switch (sig.ParamCount()) {
-            case 0: caller<false, 0>::create(L, f, cache, method); return true;
-            case 1: caller<false, 1>::create(L, f, cache, method); return true;
-            case 2: caller<false, 2>::create(L, f, cache, method); return true;
-            case 3: caller<false, 3>::create(L, f, cache, method); return true;
-            case 4: caller<false, 4>::create(L, f, cache, method); return true;
-            case 5: caller<false, 5>::create(L, f, cache, method); return true;
-            case 6: caller<false, 6>::create(L, f, cache, method); return true;
-            case 7: caller<false, 7>::create(L, f, cache, method); return true;
-            case 8: caller<false, 8>::create(L, f, cache, method); return true;
-            case 9: caller<false, 9>::create(L, f, cache, method); return true;
-            default: return false;
-            }
+    }
+
+    template <call_target kind>
+    static std::unique_ptr<caller_plan> compile(uintptr_t target, win32::cache const* cache, winmd::reader::MethodDef const& method_def) {
+        auto sig = method_def.Signature();
+        if (!sig.ReturnType()) {
+            return compile_params<result_kind::none, kind>(target, cache, method_def);
+        }
+        if (hidden_result_size(cache, sig.ReturnType(), kind)) {
+            return compile_params<result_kind::hidden, kind>(target, cache, method_def);
         }
+        return compile_params<result_kind::value, kind>(target, cache, method_def);
+    }
+
+    std::unique_ptr<caller_plan> compile_caller(uintptr_t f, win32::cache const* cache, winmd::reader::MethodDef const& method) {
+        return compile<call_target::address>(f, cache, method);
+    }
+
+    std::unique_ptr<caller_plan> compile_method(uint32_t slot, win32::cache const* cache, winmd::reader::MethodDef const& method) {
+        return compile<call_target::vtable>(slot, cache, method);
+    }
+
+    std::unique_ptr<caller_plan> compile_pointer(win32::cache const* cache, winmd::reader::TypeDef const& delegate) {
+        return compile<call_target::pointer>(0, cache, invoke_method(delegate));
+    }
+
+    void push_caller(lua_State* L, caller_plan const* plan) {
+        lua_pushlightuserdata(L, (void*)plan);
+        lua_pushcclosure(L, plan->call, 1);
+    }
+
+    void push_method(lua_State* L, caller_plan const* plan, int metatable) {
+        metatable = lua_absindex(L, metatable);
+        lua_pushlightuserdata(L, (void*)plan);
+        lua_pushvalue(L, metatable);
+        lua_pushcclosure(L, plan->call, 2);
+    }
+
+    void push_pointer(lua_State* L, caller_plan const* plan, void* f) {
+        lua_pushlightuserdata(L, (void*)plan);
+        lua_pushlightuserdata(L, f);
+        lua_pushcclosure(L, plan->call, 2);
     }
 }
@@ -3,8 +3,69 @@
 #include <stdint.h>
 #include <lua.hpp>
 #include <functional>
+#include <memory>
 #include "cache.h"
 
 namespace win32 {
-    bool create_caller(lua_State* L, uintptr_t f, win32::cache const* cache, winmd::reader::MethodDef const& method);
+    // Marshal plan of one api. Immutable once compiled, so it can be shared by every lua_State.
+    struct caller_plan {
+        explicit caller_plan(lua_CFunction call)
+            : call(call)
+        {}
+        virtual ~caller_plan() = default;
+        lua_CFunction call;
+    };
+    // Throws std::invalid_argument for unsupported signatures, returns nullptr if there are too many parameters.
+    std::unique_ptr<caller_plan> compile_caller(uintptr_t f, win32::cache const* cache, winmd::reader::MethodDef const& method);
+    void push_caller(lua_State* L, caller_plan const* plan);
+
+    // Payload of a win32::interface userdata.
+    struct interface_object {
+        void* ptr;
+    };
+    // Set in the metatables of userdata whose payload is a native pointer rather than native bytes,
+    // such as win32::interface: pointer parameters receive the pointer they hold.
+    inline char const boxed_pointer_key = 0;
+    // Native address of the userdata at idx.
+    void* userdata_pointer(lua_State* L, int idx);
+    // Plan calling vtable[slot] of the interface passed as the first Lua argument. Same errors as compile_caller.
+    std::unique_ptr<caller_plan> compile_method(uint32_t slot, win32::cache const* cache, winmd::reader::MethodDef const& method);
+    // The first argument must be a raw pointer or a userdata whose metatable is the one at index metatable.
+    void push_method(lua_State* L, caller_plan const* plan, int metatable);
+    // Plan calling a function pointer with the Invoke signature of a delegate type. Same errors as compile_caller.
+    std::unique_ptr<caller_plan> compile_pointer(win32::cache const* cache, winmd::reader::TypeDef const& delegate);
+    void push_pointer(lua_State* L, caller_plan const* plan, void* f);
+
+    // direct: must be called on the thread owning the lua_State.
+    // queued: calls from other threads are queued for dispatch_pending and return 0 at once.
+    // blocking: calls from other threads are queued and wait for dispatch_pending to run them.
+    enum class callback_mode {
+        direct,
+        queued,
+        blocking,
+    };
+    // Invoke signature of a delegate type, compiled once per process. Throws std::invalid_argument when unsupported.
+    struct callback_plan;
+    callback_plan const* compile_callback(win32::cache const* cache, winmd::reader::TypeDef const& delegate);
+    // Pushes a win32::callback userdata binding the function at idx to a native entry point, returns the entry point.
+    // The binding is released when the userdata is collected or closed.
+    void* push_callback(lua_State* L, callback_plan const* plan, int idx, callback_mode mode);
+    // Runs up to max calls queued by other threads, returns how many ran.
+    int dispatch_pending(lua_State* L, int max);
+
+    // Field plan of a struct type for table conversions, compiled once per process. Throws std::invalid_argument
+    // for fields without a Lua representation.
+    struct struct_plan;
+    struct_plan const* compile_struct(win32::cache const* cache, winmd::reader::TypeDef const& type);
+    size_t struct_size(struct_plan const* plan);
+    // Writes the fields present in the table at idx; a string is copied as the raw struct bytes.
+    // buffer is the stack index of the win32.memory or win32.struct holding dst, 0 for foreign memory;
+    // strings for pointer fields are only accepted with a buffer, which keeps them alive.
+    void pack_struct(lua_State* L, struct_plan const* plan, int idx, void* dst, int buffer);
+    // Pushes a table holding every field.
+    void unpack_struct(lua_State* L, struct_plan const* plan, void const* src);
+    // Pushes a zeroed win32::struct userdata: the raw struct bytes, with members, bitfields and
+    // anonymous union members readable and writable by name. Nested struct members read as views
+    // writing through to these bytes. Returns the bytes.
+    void* push_struct(lua_State* L, struct_plan const* plan);
 }
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <winmd_reader.h>
+#include <unordered_map>
+
+namespace win32 {
+    // Name -> RVA index of a PE export directory. Works on a file on disk
+    // (section offsets) as well as on an image mapped by the loader (RVA == offset).
+    class export_table {
+    public:
+        export_table() = default;
+
+        export_table(winmd::reader::byte_view const& image, bool mapped) {
+            parse(image, mapped);
+        }
+
+        static winmd::reader::byte_view loaded_image(void const* base) {
+            auto first = (uint8_t const*)base;
+            winmd::reader::byte_view headers { first, first + sizeof(winmd::impl::image_dos_header) };
+            auto const& dos = headers.as<winmd::impl::image_dos_header>();
+            headers = { first, first + dos.e_lfanew + sizeof(winmd::impl::image_nt_headers32plus) };
+            auto const& pe = headers.as<winmd::impl::image_nt_headers32>(dos.e_lfanew);
+            uint32_t size = pe.OptionalHeader.Magic == 0x20B
+                ? headers.as<winmd::impl::image_nt_headers32plus>(dos.e_lfanew).OptionalHeader.SizeOfImage
+                : pe.OptionalHeader.SizeOfImage;
+            return { first, first + size };
+        }
+
+        // Returns 0 for unknown names and for forwarded exports, which only the loader can resolve.
+        uint32_t find(std::string_view const& name) const noexcept {
+            auto it = m_names.find(name);
+            if (it == m_names.end()) {
+                return 0;
+            }
+            return it->second;
+        }
+
+        size_t size() const noexcept {
+            return m_names.size();
+        }
+
+    private:
+        void parse(winmd::reader::byte_view const& image, bool mapped) {
+            using namespace winmd;
+            auto const& dos = image.as<impl::image_dos_header>();
+            if (dos.e_signature != 0x5A4D) { // IMAGE_DOS_SIGNATURE
+                impl::throw_invalid("Invalid DOS signature");
+            }
+            // byte_view offsets are 32 bits: a negative or huge e_lfanew would wrap past the bounds check.
+            if (dos.e_lfanew < 0 || (uint64_t)dos.e_lfanew + sizeof(impl::image_nt_headers32) > image.size()) {
+                impl::throw_invalid("PE headers out of bounds");
+            }
+            auto const& pe = image.as<impl::image_nt_headers32>(dos.e_lfanew);
+            if (pe.Signature != 0x00004550) { // IMAGE_NT_SIGNATURE
+                impl::throw_invalid("Invalid PE signature");
+            }
+            uint32_t headers_size = 0;
+            impl::image_data_directory directory {};
+            if (pe.OptionalHeader.Magic == 0x10B) { // PE32
+                directory = pe.OptionalHeader.DataDirectory[0]; // IMAGE_DIRECTORY_ENTRY_EXPORT
+                headers_size = sizeof(impl::image_nt_headers32);
+            }
+            else if (pe.OptionalHeader.Magic == 0x20B) { // PE32+
+                auto const& pe_plus = image.as<impl::image_nt_headers32plus>(dos.e_lfanew);
+                directory = pe_plus.OptionalHeader.DataDirectory[0]; // IMAGE_DIRECTORY_ENTRY_EXPORT
+                headers_size = sizeof(impl::image_nt_headers32plus);
+            }
+            else {
+                impl::throw_invalid("Invalid optional header magic value");
+            }
+            // offset() walks the whole section table, so all of it must be inside the image.
+            uint64_t sections_end_offset = (uint64_t)dos.e_lfanew + headers_size
+                + (uint64_t)pe.FileHeader.NumberOfSections * sizeof(impl::image_section_header);
+            if (sections_end_offset > image.size()) {
+                impl::throw_invalid("PE section table out of bounds");
+            }
+            auto sections = image.as_array<impl::image_section_header>(dos.e_lfanew + headers_size, pe.FileHeader.NumberOfSections);
+            if (directory.VirtualAddress == 0 || directory.Size == 0) {
+                return;
+            }
+            auto sections_end = sections + pe.FileHeader.NumberOfSections;
+            auto offset = [&](uint32_t rva) -> uint32_t {
+                if (mapped) {
+                    return rva;
+                }
+                auto section = std::find_if(sections, sections_end, [rva](auto&& section) noexcept {
+                    return rva >= section.VirtualAddress && rva < section.VirtualAddress + section.Misc.VirtualSize;
+                });
+                if (section == sections_end) {
+                    impl::throw_invalid("PE section containing RVA not found");
+                }
+                return rva - section->VirtualAddress + section->PointerToRawData;
+            };
+
+            auto const& exports = image.as<impl::image_export_directory>(offset(directory.VirtualAddress));
+            if (exports.NumberOfNames == 0) {
+                return;
+            }
+            auto functions = image.as_array<uint32_t>(offset(exports.AddressOfFunctions), exports.NumberOfFunctions);
+            auto names = image.as_array<uint32_t>(offset(exports.AddressOfNames), exports.NumberOfNames);
+            auto ordinals = image.as_array<uint16_t>(offset(exports.AddressOfNameOrdinals), exports.NumberOfNames);
+            m_names.reserve(exports.NumberOfNames);
+            for (uint32_t i = 0; i < exports.NumberOfNames; ++i) {
+                if (ordinals[i] >= exports.NumberOfFunctions) {
+                    continue;
+                }
+                uint32_t rva = functions[ordinals[i]];
+                if (rva >= directory.VirtualAddress && rva < directory.VirtualAddress + directory.Size) {
+                    continue;
+                }
+                auto view = image.seek(offset(names[i]));
+                auto last = std::find(view.begin(), view.end(), 0);
+                if (last == view.end()) {
+                    impl::throw_invalid("Missing string terminator");
+                }
+                m_names.try_emplace(std::string_view { (char const*)view.begin(), (size_t)(last - view.begin()) }, rva);
+            }
+        }
+
+        std::unordered_map<std::string_view, uint32_t> m_names;
+    };
+}
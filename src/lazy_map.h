@@ -0,0 +1,33 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+
+namespace win32 {
+    // Map filled on first use and shared by every thread. Each map has its own reader/writer
+    // lock, so a miss that builds a struct layout doesn't stall readers of unrelated tables.
+    // Entries are never replaced or erased: references stay valid as long as the map.
+    template <typename Key, typename Value>
+    class lazy_map {
+    public:
+        Value const* find(Key const& key) const {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto it = m_map.find(key);
+            if (it == m_map.end()) {
+                return nullptr;
+            }
+            return &it->second;
+        }
+
+        // Keeps the first value when two threads built the same entry concurrently.
+        Value const& insert(Key const& key, Value&& value) {
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            return m_map.try_emplace(key, std::move(value)).first->second;
+        }
+
+    private:
+        mutable std::shared_mutex m_mutex;
+        std::map<Key, Value> m_map;
+    };
+}
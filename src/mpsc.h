@@ -0,0 +1,199 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "thunk.h"
+
+namespace win32 {
+    struct mpsc_node {
+        std::atomic<mpsc_node*> next { nullptr };
+    };
+
+    // Intrusive multi-producer single-consumer queue (Vyukov). push is wait-free and may be
+    // called from any thread; pop must only be called by the owning thread.
+    class mpsc_queue {
+    public:
+        mpsc_queue() = default;
+        mpsc_queue(mpsc_queue const&) = delete;
+        mpsc_queue& operator=(mpsc_queue const&) = delete;
+
+        void push(mpsc_node* node) noexcept {
+            node->next.store(nullptr, std::memory_order_relaxed);
+            mpsc_node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+            prev->next.store(node, std::memory_order_release);
+        }
+
+        // Returns nullptr when empty, or when a producer is halfway through push; the node
+        // becomes visible on a later call.
+        mpsc_node* pop() noexcept {
+            mpsc_node* tail = m_tail;
+            mpsc_node* next = tail->next.load(std::memory_order_acquire);
+            if (tail == &m_stub) {
+                if (!next) {
+                    return nullptr;
+                }
+                m_tail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next) {
+                m_tail = next;
+                return tail;
+            }
+            if (tail != m_head.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            push(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next) {
+                m_tail = next;
+                return tail;
+            }
+            return nullptr;
+        }
+
+    private:
+        mpsc_node m_stub;
+        std::atomic<mpsc_node*> m_head { &m_stub };
+        mpsc_node* m_tail = &m_stub;
+    };
+
+    // Call made on a foreign thread, run on the thread owning the call_queue.
+    struct pending_call : mpsc_node {
+        void* target = nullptr;
+        uintptr_t args[thunk_max_params] = {};
+        uintptr_t result = 0;
+        bool wait = false;  // the producer blocks on it and owns it; otherwise the queue discards it
+        bool done = false;  // guarded by the queue mutex
+    };
+
+    // Queue of pending calls with a single owner thread. Every producer is counted from before it
+    // looks at the queue until it last touches it, so close() can wait for all of them: once it
+    // returns no call is queued or waiting and the queue may be destroyed.
+    class call_queue {
+    public:
+        // Receives the calls nobody waits for, after they ran or were dropped.
+        using discard_fn = void (*)(pending_call* call);
+
+        explicit call_queue(discard_fn discard) noexcept
+            : m_discard(discard)
+        { }
+        call_queue(call_queue const&) = delete;
+        call_queue& operator=(call_queue const&) = delete;
+        ~call_queue() {
+            close();
+        }
+
+        bool owner() const noexcept {
+            return std::this_thread::get_id() == m_owner;
+        }
+
+        // Any thread. The call belongs to the queue, unless the queue is closed and false is returned.
+        bool post(pending_call* call) noexcept {
+            call->wait = false;
+            if (!enter()) {
+                return false;
+            }
+            m_queue.push(call);
+            leave();
+            return true;
+        }
+
+        // Any thread but the owner: queues the call and blocks until the owner completes it.
+        // Returns false, with call.result untouched, when the queue is closed.
+        bool send(pending_call& call) {
+            call.wait = true;
+            call.done = false;
+            if (!enter()) {
+                return false;
+            }
+            m_queue.push(&call);
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [&] { return call.done; });
+            }
+            leave();
+            return true;
+        }
+
+        // Owner thread only, from here on.
+        pending_call* pop() noexcept {
+            if (!m_backlog.empty()) {
+                auto call = m_backlog.front();
+                m_backlog.pop_front();
+                return call;
+            }
+            return static_cast<pending_call*>(m_queue.pop());
+        }
+
+        void complete(pending_call* call) {
+            if (!call->wait) {
+                m_discard(call);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            call->done = true;
+            m_cv.notify_all();
+        }
+
+        // Completes the queued calls matching pred without running them, keeps the order of the others.
+        template <typename Pred>
+        void drop_if(Pred&& pred) {
+            while (auto call = static_cast<pending_call*>(m_queue.pop())) {
+                m_backlog.push_back(call);
+            }
+            std::deque<pending_call*> keep;
+            for (auto call : m_backlog) {
+                if (pred(*call)) {
+                    call->result = 0;
+                    complete(call);
+                }
+                else {
+                    keep.push_back(call);
+                }
+            }
+            m_backlog.swap(keep);
+        }
+
+        void close() {
+            m_closed.store(true, std::memory_order_seq_cst);
+            for (;;) {
+                while (auto call = pop()) {
+                    call->result = 0;
+                    complete(call);
+                }
+                if (m_producers.load(std::memory_order_acquire) == 0) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        bool enter() noexcept {
+            m_producers.fetch_add(1, std::memory_order_seq_cst);
+            if (m_closed.load(std::memory_order_seq_cst)) {
+                leave();
+                return false;
+            }
+            return true;
+        }
+
+        void leave() noexcept {
+            m_producers.fetch_sub(1, std::memory_order_release);
+        }
+
+        mpsc_queue m_queue;
+        std::deque<pending_call*> m_backlog;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::atomic<bool> m_closed { false };
+        std::atomic<uint32_t> m_producers { 0 };
+        std::thread::id m_owner = std::this_thread::get_id();
+        discard_fn m_discard;
+    };
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <atomic>
+#include <new>
+#include <utility>
+
+#if !defined(_WIN32) && !defined(__stdcall)
+#define __stdcall // one calling convention on other platforms
+#endif
+
+namespace win32 {
+    template <typename>
+    struct function_type_;
+    template <size_t ...Is>
+    struct function_type_<std::index_sequence<Is...>> {
+        using type = uintptr_t (__stdcall *)(decltype(Is, uintptr_t())...);
+    };
+    template <size_t N>
+    using function_type = typename function_type_<std::make_index_sequence<N>>::type;
+
+    // Receives the native arguments of a callback, returns its result.
+    using thunk_dispatch = uintptr_t (*)(void* context, uintptr_t const* args);
+    // Disposes of the context of a released entry once no call is running through it.
+    using thunk_retire = void (*)(void* context);
+
+    // Slots are allocated a chunk at a time, the first time every slot before them is in use.
+    constexpr size_t thunk_chunk_size = 32;
+    constexpr size_t thunk_max_chunks = 16;
+    constexpr size_t thunk_pool_size = thunk_chunk_size * thunk_max_chunks; // per signature size
+    constexpr size_t thunk_max_params = 9;
+
+    // Native entry points for callbacks of N pointer-sized parameters. Every entry is an ordinary
+    // function compiled into the module, so handing one out never allocates executable memory or
+    // generates code; it only binds a free slot to a dispatch function. The slots behind the
+    // entries grow by chunks, a program holding few callbacks only pays for the first one.
+    template <size_t N, typename = std::make_index_sequence<N>>
+    struct thunk_pool;
+
+    template <size_t N, size_t ...Is>
+    struct thunk_pool<N, std::index_sequence<Is...>> {
+        static void* acquire(thunk_dispatch dispatch, void* context) noexcept {
+            for (size_t c = 0; c < thunk_max_chunks; ++c) {
+                auto slots = get_chunk(c);
+                if (!slots) {
+                    return nullptr;
+                }
+                for (size_t i = 0; i < thunk_chunk_size; ++i) {
+                    auto& s = slots[i];
+                    uint32_t expected = slot_free;
+                    if (s.state.compare_exchange_strong(expected, 0, std::memory_order_acquire)) {
+                        s.context = context;
+                        s.retire = nullptr;
+                        s.dispatch.store(dispatch, std::memory_order_release);
+                        return (void*)entries[c * thunk_chunk_size + i];
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+        // New calls through the entry return 0 from now on. retire(context) runs once the calls
+        // already inside dispatch have returned: here, or on the thread of the last of them.
+        static bool release(void* entry, thunk_retire retire) noexcept {
+            for (size_t i = 0; i < thunk_pool_size; ++i) {
+                if ((void*)entries[i] == entry) {
+                    auto& s = chunks[i / thunk_chunk_size].load(std::memory_order_acquire)[i % thunk_chunk_size];
+                    s.retire = retire;
+                    if ((s.state.fetch_or(slot_retired, std::memory_order_acq_rel) & slot_calls) == 0) {
+                        finish(s);
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        // state counts the calls inside the slot; the flag bits make new calls bail out.
+        static constexpr uint32_t slot_free = 0x80000000u;
+        static constexpr uint32_t slot_retired = 0x40000000u;
+        static constexpr uint32_t slot_calls = slot_retired - 1;
+
+        struct slot {
+            std::atomic<uint32_t> state { slot_free };
+            std::atomic<thunk_dispatch> dispatch { nullptr };
+            void* context = nullptr;
+            thunk_retire retire = nullptr;
+        };
+
+        // Exactly one thread moves a retired slot without calls to free, the others fail the exchange.
+        static void finish(slot& s) noexcept {
+            uint32_t expected = slot_retired;
+            if (!s.state.compare_exchange_strong(expected, slot_retired | slot_free, std::memory_order_acq_rel)) {
+                return;
+            }
+            auto retire = s.retire;
+            auto context = s.context;
+            s.dispatch.store(nullptr, std::memory_order_relaxed);
+            s.context = nullptr;
+            s.retire = nullptr;
+            if (retire) {
+                retire(context);
+            }
+            s.state.fetch_and(~slot_retired, std::memory_order_release);
+        }
+
+        static void leave(slot& s) noexcept {
+            if (s.state.fetch_sub(1, std::memory_order_acq_rel) == (slot_retired | 1)) {
+                finish(s);
+            }
+        }
+
+        // Chunks are never freed: native code may keep an entry point for as long as the module is loaded.
+        static slot* get_chunk(size_t c) noexcept {
+            auto slots = chunks[c].load(std::memory_order_acquire);
+            if (slots) {
+                return slots;
+            }
+            auto fresh = new (std::nothrow) slot[thunk_chunk_size];
+            if (!fresh) {
+                return nullptr;
+            }
+            if (!chunks[c].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+                delete[] fresh;
+                return slots;
+            }
+            return fresh;
+        }
+
+        // Only reachable once acquire handed the entry out, so its chunk exists.
+        template <size_t Slot>
+        static uintptr_t __stdcall entry(decltype(Is, uintptr_t())... args) {
+            uintptr_t argv[] = { args..., 0 };
+            auto& s = chunks[Slot / thunk_chunk_size].load(std::memory_order_acquire)[Slot % thunk_chunk_size];
+            if (s.state.fetch_add(1, std::memory_order_acq_rel) & (slot_free | slot_retired)) {
+                leave(s);
+                return 0;
+            }
+            auto result = s.dispatch.load(std::memory_order_acquire)(s.context, argv);
+            leave(s);
+            return result;
+        }
+
+        template <size_t ...Slots>
+        static constexpr std::array<function_type<N>, sizeof...(Slots)> make_entries(std::index_sequence<Slots...>) {
+            return {{ &entry<Slots>... }};
+        }
+
+        static inline std::atomic<slot*> chunks[thunk_max_chunks] {};
+        static constexpr std::array<function_type<N>, thunk_pool_size> entries = make_entries(std::make_index_sequence<thunk_pool_size>());
+    };
+
+    // Entry point taking `params` arguments bound to dispatch(context, ...), or nullptr when the pool is exhausted.
+    inline void* acquire_thunk(size_t params, thunk_dispatch dispatch, void* context) noexcept {
+        switch (params) {
+        case 0: return thunk_pool<0>::acquire(dispatch, context);
+        case 1: return thunk_pool<1>::acquire(dispatch, context);
+        case 2: return thunk_pool<2>::acquire(dispatch, context);
+        case 3: return thunk_pool<3>::acquire(dispatch, context);
+        case 4: return thunk_pool<4>::acquire(dispatch, context);
+        case 5: return thunk_pool<5>::acquire(dispatch, context);
+        case 6: return thunk_pool<6>::acquire(dispatch, context);
+        case 7: return thunk_pool<7>::acquire(dispatch, context);
+        case 8: return thunk_pool<8>::acquire(dispatch, context);
+        case 9: return thunk_pool<9>::acquire(dispatch, context);
+        default: return nullptr;
+        }
+    }
+
+    inline void release_thunk(size_t params, void* entry, thunk_retire retire = nullptr) noexcept {
+        switch (params) {
+        case 0: thunk_pool<0>::release(entry, retire); break;
+        case 1: thunk_pool<1>::release(entry, retire); break;
+        case 2: thunk_pool<2>::release(entry, retire); break;
+        case 3: thunk_pool<3>::release(entry, retire); break;
+        case 4: thunk_pool<4>::release(entry, retire); break;
+        case 5: thunk_pool<5>::release(entry, retire); break;
+        case 6: thunk_pool<6>::release(entry, retire); break;
+        case 7: thunk_pool<7>::release(entry, retire); break;
+        case 8: thunk_pool<8>::release(entry, retire); break;
+        case 9: thunk_pool<9>::release(entry, retire); break;
+        default: break;
+        }
+    }
+}
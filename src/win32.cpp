@@ -1,6 +1,17 @@
 #include <winmd_reader.h>
 #include <lua.hpp>
 #include "caller.h"
+#include "exports.h"
+#include "lazy_map.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 using namespace winmd::reader;
 
@@ -12,55 +23,333 @@ namespace win32 {
         const char* str = luaL_checklstring(L, idx, &len);
         return {str, len};
     }
+    // Returns f(). A std::exception, such as the std::invalid_argument of an unsupported signature,
+    // becomes a Lua error prefixed with type (and member) when given. lua_error is only called once
+    // the exception is gone: it must not unwind through a catch block.
+    template <typename F>
+    static auto raise_on_throw(lua_State* L, F&& f, char const* type = nullptr, char const* member = nullptr) {
+        decltype(f()) result {};
+        bool failed = false;
+        try {
+            result = f();
+        } catch (std::exception const& e) {
+            if (member) {
+                lua_pushfstring(L, "%s.%s: %s", type, member, e.what());
+            }
+            else if (type) {
+                lua_pushfstring(L, "%s: %s", type, e.what());
+            }
+            else {
+                lua_pushstring(L, e.what());
+            }
+            failed = true;
+        }
+        if (failed) {
+            lua_error(L);
+        }
+        return result;
+    }
+    static uint8_t const* check_address(lua_State* L, int idx) {
+        switch (lua_type(L, idx)) {
+        case LUA_TUSERDATA:
+            return (uint8_t const*)userdata_pointer(L, idx);
+        case LUA_TLIGHTUSERDATA:
+            return (uint8_t const*)lua_touserdata(L, idx);
+        default:
+            return (uint8_t const*)(uintptr_t)luaL_checkinteger(L, idx);
+        }
+    }
 
+    // Shared by every lua_State of the process. Lookups take a shared lock,
+    // only loading a new module takes the exclusive one; entries never change once inserted.
     class native_modules {
     public:
         void* find(std::string_view module, std::string_view api) {
-            HMODULE dll = find_module(module);
-            if (!dll) {
+            auto m = find_module(module);
+            if (!m) {
                 return nullptr;
             }
-            return (void*)GetProcAddress(dll, api.data());
+            if (uint32_t rva = m->exports.find(api)) {
+                return (void*)((uint8_t const*)m->handle + rva);
+            }
+            return (void*)GetProcAddress(m->handle, api.data());
         }
     private:
-        HMODULE find_module(std::string_view module) {
-            auto it = m_modules.find(module);
-            if (it != m_modules.end()) {
-                return it->second;
+        struct native_module {
+            HMODULE handle = NULL;
+            export_table exports;
+        };
+        native_module const* find_module(std::string_view module) {
+            {
+                std::shared_lock<std::shared_mutex> lock(m_mutex);
+                auto it = m_modules.find(module);
+                if (it != m_modules.end()) {
+                    return it->second.handle ? &it->second : nullptr;
+                }
+            }
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            auto [it, inserted] = m_modules.try_emplace(module);
+            auto& m = it->second;
+            if (inserted) {
+                m.handle = LoadLibraryA(module.data());
+                if (m.handle) {
+                    try {
+                        m.exports = export_table(export_table::loaded_image(m.handle), true);
+                    }
+                    catch (std::exception const&) {
+                        // fall back to GetProcAddress
+                    }
+                }
             }
-            HMODULE dll = LoadLibraryA(module.data());
-            m_modules.try_emplace(module, dll);
-            return dll;
+            return m.handle ? &m : nullptr;
         }
-        std::map<std::string_view, HMODULE> m_modules;
+        std::shared_mutex m_mutex;
+        std::map<std::string_view, native_module> m_modules;
     };
 
-    static int apis_get(lua_State* L) {
-        static native_modules native_apis;
-        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
-        auto name = lua_checkstrview(L, 2);
-        auto api = cache->find_api(name);
-        if (!api) {
-            return luaL_error(L, "%s not found.", name.data());
+    static native_modules native_apis;
+
+    // Names of the apis and constants touched by this process, used as a warmup list on the next start.
+    // Off until LUAWIN32_PROFILE or win32.record_profile turns it on: a miss then costs one atomic load.
+    class access_profile {
+    public:
+        void record_api(std::string_view name) {
+            record(m_apis, name);
         }
-        auto module = api->ImportScope().Name();
+        void record_constant(std::string_view name) {
+            record(m_constants, name);
+        }
+        bool enable(bool on) {
+            return m_enabled.exchange(on, std::memory_order_relaxed);
+        }
+        bool save(const char* path) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::ofstream f(path, std::ios::binary | std::ios::trunc);
+            for (auto const& name : m_apis) {
+                f << "a " << name << '\n';
+            }
+            for (auto const& name : m_constants) {
+                f << "c " << name << '\n';
+            }
+            return (bool)f;
+        }
+        static bool load(const char* path, std::vector<std::string>& apis, std::vector<std::string>& constants) {
+            std::ifstream f(path, std::ios::binary);
+            if (!f) {
+                return false;
+            }
+            std::string line;
+            while (std::getline(f, line)) {
+                if (line.size() < 3 || line[1] != ' ') {
+                    continue;
+                }
+                switch (line[0]) {
+                case 'a': apis.emplace_back(line, 2); break;
+                case 'c': constants.emplace_back(line, 2); break;
+                default: break;
+                }
+            }
+            return true;
+        }
+    private:
+        using name_set = std::set<std::string, std::less<>>;
+        void record(name_set& set, std::string_view name) {
+            if (!m_enabled.load(std::memory_order_relaxed)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (set.find(name) == set.end()) {
+                set.emplace(name);
+            }
+        }
+        std::atomic<bool> m_enabled { false };
+        std::mutex m_mutex;
+        name_set m_apis;
+        name_set m_constants;
+    };
+
+    static access_profile touched;
+
+    // Process-wide marshal plans, keyed by metadata row. Lua closures only hold a pointer to them.
+    using caller_plans = lazy_map<uint32_t, std::unique_ptr<caller_plan>>;
+
+    static caller_plans plans;        // ImplMap row
+    static caller_plans method_plans; // MethodDef row; a method has the same slot in every derived interface
+    static caller_plans pointer_plans; // delegate TypeDef row
+
+    static void bind_api(lua_State* L, win32::cache const* cache, ImplMap const& api) {
+        if (auto plan = plans.find(api.index())) {
+            push_caller(L, plan->get());
+            return;
+        }
+        auto name = api.ImportName();
+        auto module = api.ImportScope().Name();
         void* address = native_apis.find(module, name);
         if (!address) {
-            return luaL_error(L, "%s can't load.", name.data());
+            luaL_error(L, "%s can't load.", name.data());
+            return;
         }
-        auto callconv = enum_mask(api->MappingFlags(), PInvokeAttributes::CallConvMask);
+        auto callconv = enum_mask(api.MappingFlags(), PInvokeAttributes::CallConvMask);
         if (callconv != PInvokeAttributes::CallConvPlatformapi && callconv != PInvokeAttributes::CallConvStdcall) {
-            return luaL_error(L, "%s calling convention not implemented.", name.data());
+            luaL_error(L, "%s calling convention not implemented.", name.data());
+            return;
         }
-        bool ok = create_caller(L, (uintptr_t)address, cache, api->MemberForwarded());
-        if (!ok) {
-            return luaL_error(L, "%s has too many parameters.", name.data());
+        auto plan = raise_on_throw(L, [&] {
+            return compile_caller((uintptr_t)address, cache, api.MemberForwarded());
+        }, name.data());
+        if (!plan) {
+            luaL_error(L, "%s has too many parameters.", name.data());
+            return;
         }
+        push_caller(L, plans.insert(api.index(), std::move(plan)).get());
+    }
+
+    static int apis_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 2);
+        auto api = cache->find_api(name);
+        if (!api) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        bind_api(L, cache, *api);
+        touched.record_api(name);
         lua_pushvalue(L, -1);
         lua_insert(L, 2);
         lua_rawset(L, -4);
         return 1;
     }
+    static int preload_api(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto api = cache->database().ImplMap[(uint32_t)lua_tointeger(L, 1)];
+        auto name = api.ImportName();
+        lua_pushlstring(L, name.data(), name.size());
+        bind_api(L, cache, api);
+        lua_rawset(L, lua_upvalueindex(2));
+        return 0;
+    }
+    // Threads started by async preloads. They read the metadata and fill native_apis, so they are
+    // joined when a lua_State closes (before Lua unloads this module) and, failing that, at exit.
+    class preload_threads {
+    public:
+        ~preload_threads() {
+            join();
+        }
+        template <typename F>
+        void start(F&& f) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_threads.emplace_back(std::forward<F>(f));
+        }
+        void join() {
+            std::vector<std::thread> threads;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                threads.swap(m_threads);
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+        }
+    private:
+        std::mutex m_mutex;
+        std::vector<std::thread> m_threads;
+    };
+
+    // Constructed after the metadata cache in open(), hence destroyed before it.
+    static preload_threads& background_preloads() {
+        static preload_threads threads;
+        return threads;
+    }
+
+    static int preload_join(lua_State*) {
+        background_preloads().join();
+        return 0;
+    }
+
+    // What preload_apis does with an api that fails to bind.
+    enum class preload_errors {
+        raise,
+        skip,
+        warn,
+    };
+
+    static int preload_apis(lua_State* L, win32::cache const* cache, int apis_idx, std::vector<ImplMap>&& apis, preload_errors errors, bool async) {
+        if (async) {
+            // Lua state can't be entered from another thread, only warm up the native modules.
+            lua_Integer n = (lua_Integer)apis.size();
+            background_preloads().start([apis = std::move(apis)]() {
+                for (auto const& api : apis) {
+                    native_apis.find(api.ImportScope().Name(), api.ImportName());
+                }
+            });
+            return (int)n;
+        }
+        apis_idx = lua_absindex(L, apis_idx);
+        lua_pushlightuserdata(L, (void*)cache);
+        lua_pushvalue(L, apis_idx);
+        lua_pushcclosure(L, preload_api, 2);
+        int f = lua_gettop(L);
+        int n = 0;
+        for (auto const& api : apis) {
+            auto name = api.ImportName();
+            lua_pushlstring(L, name.data(), name.size());
+            if (lua_rawget(L, apis_idx) != LUA_TNIL) {
+                lua_pop(L, 1);
+                continue;
+            }
+            lua_pop(L, 1);
+            lua_pushvalue(L, f);
+            lua_pushinteger(L, api.index());
+            if (errors == preload_errors::raise) {
+                lua_call(L, 1, 0);
+            }
+            else if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+                if (errors == preload_errors::warn) {
+                    lua_warning(L, "win32 warmup: ", 1);
+                    auto msg = lua_tostring(L, -1);
+                    lua_warning(L, msg ? msg : "error object is not a string", 0);
+                }
+                lua_pop(L, 1);
+                continue;
+            }
+            n++;
+        }
+        lua_pop(L, 1);
+        return n;
+    }
+    static int func_preload(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_Integer n = luaL_len(L, 1);
+        std::vector<ImplMap> apis;
+        apis.reserve((size_t)n);
+        for (lua_Integer i = 1; i <= n; ++i) {
+            lua_geti(L, 1, i);
+            auto name = lua_checkstrview(L, -1);
+            auto api = cache->find_api(name);
+            if (!api) {
+                return luaL_error(L, "%s not found.", name.data());
+            }
+            apis.push_back(*api);
+            lua_pop(L, 1);
+        }
+        lua_pushinteger(L, preload_apis(L, cache, lua_upvalueindex(2), std::move(apis), preload_errors::raise, lua_toboolean(L, 2)));
+        return 1;
+    }
+    static int func_preload_namespace(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto ns = lua_checkstrview(L, 1);
+        auto index = raise_on_throw(L, [&] { return cache->find_namespace(ns); });
+        if (!index) {
+            return luaL_error(L, "%s not found.", ns.data());
+        }
+        std::vector<ImplMap> apis;
+        apis.reserve(index->apis.size());
+        for (auto const& [name, impl] : index->apis) {
+            apis.push_back(impl);
+        }
+        lua_pushinteger(L, preload_apis(L, cache, lua_upvalueindex(2), std::move(apis), preload_errors::skip, lua_toboolean(L, 2)));
+        return 1;
+    }
     static int init_apis(lua_State* L, win32::cache const& cache) {
         lua_newtable(L);
         static luaL_Reg mt[] = {
@@ -73,57 +362,47 @@ namespace win32 {
         lua_setmetatable(L, -2);
         return 1;
     }
-    static int constants_get(lua_State* L) {
-        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
-        auto name = lua_checkstrview(L, 2);
-        auto constant = cache->find_constant(name);
-        if (!constant) {
-            return luaL_error(L, "%s not found.", name.data());
-        }
-        switch (constant->Type()) {
-        case ConstantType::Boolean:
-            lua_pushboolean(L, constant->ValueBoolean());
-            break;
-        case ConstantType::Char:
-            lua_pushinteger(L, constant->ValueChar());
-            break;
-        case ConstantType::Int8:
-            lua_pushinteger(L, constant->ValueInt8());
-            break;
-        case ConstantType::UInt8:
-            lua_pushinteger(L, constant->ValueUInt8());
-            break;
-        case ConstantType::Int16:
-            lua_pushinteger(L, constant->ValueInt16());
-            break;
-        case ConstantType::UInt16:
-            lua_pushinteger(L, constant->ValueUInt16());
+    static void push_constant(lua_State* L, win32::cache const* cache, constant_value const& value) {
+        switch (value.type) {
+        case constant_value::kind::boolean:
+            lua_pushboolean(L, value.payload != 0);
             break;
-        case ConstantType::Int32:
-            lua_pushinteger(L, constant->ValueInt32());
+        case constant_value::kind::integer:
+            lua_pushinteger(L, (lua_Integer)value.integer());
             break;
-        case ConstantType::UInt32:
-            lua_pushinteger(L, constant->ValueUInt32());
+        case constant_value::kind::number:
+            lua_pushnumber(L, value.number());
             break;
-        case ConstantType::Int64:
-            lua_pushinteger(L, constant->ValueInt64());
+        case constant_value::kind::string: {
+            auto str = cache->string_constant(cache->database().Constant[(uint32_t)value.payload]);
+            lua_pushlstring(L, str.data(), str.size());
             break;
-        case ConstantType::UInt64:
-            lua_pushinteger(L, constant->ValueUInt64());
-            break;
-        case ConstantType::Float32:
-            lua_pushnumber(L, constant->ValueFloat32());
-            break;
-        case ConstantType::Float64:
-            lua_pushnumber(L, constant->ValueFloat64());
+        }
+        case constant_value::kind::guid:
+            // A copy: scripts must not get a writable pointer into the process-wide cache.
+            // Decoding the attribute blob can throw, and this runs inside Lua C functions.
+            if (auto guid = raise_on_throw(L, [&] { return cache->guid_constant(cache->database().Field[(uint32_t)value.payload]); })) {
+                lua_pushlstring(L, (const char*)guid, 16);
+            }
+            else {
+                lua_pushnil(L);
+            }
             break;
-        case ConstantType::String:
-        case ConstantType::Class:
+        case constant_value::kind::null:
         default:
-            //TODO
             lua_pushnil(L);
             break;
         }
+    }
+    static int constants_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 2);
+        auto constant = cache->find_constant(name);
+        if (!constant) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        push_constant(L, cache, *constant);
+        touched.record_constant(name);
         lua_pushvalue(L, -1);
         lua_insert(L, 2);
         lua_rawset(L, -4);
@@ -141,6 +420,578 @@ namespace win32 {
         lua_setmetatable(L, -2);
         return 1;
     }
+    static int enums_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 2);
+        auto type = cache->find_enum(name);
+        if (!type) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        auto const& info = cache->enum_definition(type);
+        lua_createtable(L, 0, (int)info.enumerators.size());
+        for (auto const& e : info.enumerators) {
+            lua_pushlstring(L, e.name.data(), e.name.size());
+            lua_pushinteger(L, (lua_Integer)e.value);
+            lua_rawset(L, -3);
+        }
+        lua_createtable(L, 0, 1);
+        lua_pushlightuserdata(L, (void*)&info);
+        lua_setfield(L, -2, "__enum");
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_insert(L, 2);
+        lua_rawset(L, -4);
+        return 1;
+    }
+    static int init_enums(lua_State* L, win32::cache const& cache) {
+        lua_newtable(L);
+        static luaL_Reg mt[] = {
+            { "__index", enums_get },
+            { NULL, NULL },
+        };
+        luaL_newlibtable(L, mt);
+        lua_pushlightuserdata(L, (void*)&cache);
+        luaL_setfuncs(L, mt, 1);
+        lua_setmetatable(L, -2);
+        return 1;
+    }
+    static enum_info const& check_enum(lua_State* L, int idx) {
+        if (lua_type(L, idx) == LUA_TTABLE) {
+            if (lua_getmetatable(L, idx)) {
+                lua_getfield(L, -1, "__enum");
+                auto info = (enum_info const*)lua_touserdata(L, -1);
+                lua_pop(L, 2);
+                if (info) {
+                    return *info;
+                }
+            }
+            luaL_typeerror(L, idx, "enum");
+        }
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, idx);
+        auto type = cache->find_enum(name);
+        if (!type) {
+            luaL_error(L, "%s not found.", name.data());
+        }
+        return cache->enum_definition(type);
+    }
+    static int func_enum_name(lua_State* L) {
+        auto const& info = check_enum(L, 1);
+        auto e = info.find((int64_t)luaL_checkinteger(L, 2));
+        if (!e) {
+            return 0;
+        }
+        lua_pushlstring(L, e->name.data(), e->name.size());
+        return 1;
+    }
+    // win32.callback(delegate, function [, mode]): native function pointer calling function, kept alive by the returned userdata.
+    static int func_callback(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 1);
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+        static const char* const modes[] = { "direct", "queued", "blocking", NULL };
+        auto mode = (callback_mode)luaL_checkoption(L, 3, "direct", modes);
+        auto type = cache->find_type(name, category::delegate_type);
+        if (!type) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        auto plan = raise_on_throw(L, [&] { return compile_callback(cache, type); }, name.data());
+        void* entry = push_callback(L, plan, 2, mode);
+        lua_pushlightuserdata(L, entry);
+        return 2;
+    }
+    static int interface_method_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto const& info = *(interface_info const*)lua_touserdata(L, lua_upvalueindex(2));
+        auto name = lua_checkstrview(L, 2);
+        auto it = info.methods.find(name);
+        if (it == info.methods.end()) {
+            return luaL_error(L, "%s.%s not found.", info.type.TypeName().data(), name.data());
+        }
+        auto const& method = it->second;
+        auto found = method_plans.find(method.def.index());
+        caller_plan const* plan = found ? found->get() : nullptr;
+        if (!plan) {
+            auto compiled = raise_on_throw(L, [&] {
+                return compile_method(method.slot, cache, method.def);
+            }, info.type.TypeName().data(), name.data());
+            if (!compiled) {
+                return luaL_error(L, "%s.%s has too many parameters.", info.type.TypeName().data(), name.data());
+            }
+            plan = method_plans.insert(method.def.index(), std::move(compiled)).get();
+        }
+        push_method(L, plan, lua_upvalueindex(3));
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, 1);
+        return 1;
+    }
+    // Metatable shared by every object of one interface type in this lua_State, created on first use.
+    static void push_interface_metatable(lua_State* L, win32::cache const* cache, interface_info const& info) {
+        if (luaL_getsubtable(L, LUA_REGISTRYINDEX, "win32::interfaces")) {
+            if (lua_rawgeti(L, -1, (lua_Integer)info.type.index()) == LUA_TTABLE) {
+                lua_remove(L, -2);
+                return;
+            }
+            lua_pop(L, 1);
+        }
+        lua_createtable(L, 0, 3);
+        lua_pushstring(L, "win32::interface");
+        lua_setfield(L, -2, "__name");
+        lua_pushboolean(L, 1);
+        lua_rawsetp(L, -2, &boxed_pointer_key);
+        lua_createtable(L, 0, (int)info.methods.size());
+        lua_createtable(L, 0, 1);
+        lua_pushlightuserdata(L, (void*)cache);
+        lua_pushlightuserdata(L, (void*)&info);
+        lua_pushvalue(L, -5);
+        lua_pushcclosure(L, interface_method_get, 3);
+        lua_setfield(L, -2, "__index");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, -2, "__index");
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, (lua_Integer)info.type.index());
+        lua_remove(L, -2);
+    }
+    // win32.interface(name, ptr): COM object whose methods are called through its vtable, e.g. obj:Release().
+    static int func_interface(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 1);
+        void* ptr = (void*)check_address(L, 2);
+        auto type = cache->find_type(name, category::interface_type);
+        if (!type) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        auto info = raise_on_throw(L, [&] { return &cache->interface_definition(type); }, name.data());
+        auto obj = (interface_object*)lua_newuserdatauv(L, sizeof(interface_object), 0);
+        obj->ptr = ptr;
+        push_interface_metatable(L, cache, *info);
+        lua_setmetatable(L, -2);
+        return 1;
+    }
+    // win32.cast_fn(delegate, ptr): callable invoking the native function pointer ptr.
+    static int func_cast_fn(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 1);
+        void* f = lua_islightuserdata(L, 2)
+            ? lua_touserdata(L, 2)
+            : (void*)(uintptr_t)luaL_checkinteger(L, 2);
+        if (!f) {
+            return luaL_argerror(L, 2, "null function pointer");
+        }
+        auto type = cache->find_type(name, category::delegate_type);
+        if (!type) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        auto found = pointer_plans.find(type.index());
+        caller_plan const* plan = found ? found->get() : nullptr;
+        if (!plan) {
+            auto compiled = raise_on_throw(L, [&] { return compile_pointer(cache, type); }, name.data());
+            if (!compiled) {
+                return luaL_error(L, "%s has too many parameters.", name.data());
+            }
+            plan = pointer_plans.insert(type.index(), std::move(compiled)).get();
+        }
+        push_pointer(L, plan, f);
+        return 1;
+    }
+    static struct_plan const* check_struct_plan(lua_State* L, int idx) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, idx);
+        auto type = cache->find_type(name, category::struct_type);
+        if (!type) {
+            luaL_error(L, "%s not found.", name.data());
+        }
+        return raise_on_throw(L, [&] { return compile_struct(cache, type); }, name.data());
+    }
+    // n structs of size bytes fit in len bytes; never computes n * size, which could wrap.
+    static bool structs_fit(size_t n, size_t size, size_t len) {
+        return size == 0 || n <= len / size;
+    }
+    // Stack index of the userdata at idx when its own bytes are at p, 0 for foreign memory.
+    static int own_buffer(lua_State* L, int idx, void const* p) {
+        return lua_type(L, idx) == LUA_TUSERDATA && lua_touserdata(L, idx) == p ? idx : 0;
+    }
+    // win32.pack(type, tbl [, mem]): struct bytes from a table of fields, or an array of them from a sequence of tables.
+    // Without mem, returns a new zeroed win32.memory.
+    static int func_pack(lua_State* L) {
+        auto plan = check_struct_plan(L, 1);
+        size_t size = struct_size(plan);
+        bool array = false;
+        if (lua_type(L, 2) == LUA_TTABLE) {
+            array = lua_rawgeti(L, 2, 1) == LUA_TTABLE;
+            lua_pop(L, 1);
+        }
+        size_t n = array ? (size_t)lua_rawlen(L, 2) : 1;
+        luaL_argcheck(L, structs_fit(n, size, PTRDIFF_MAX), 2, "too many structs");
+        uint8_t* dst;
+        int buffer;
+        if (lua_isnoneornil(L, 3)) {
+            lua_settop(L, 2);
+            dst = (uint8_t*)lua_newuserdatauv(L, n * size, 1);
+            memset(dst, 0, n * size);
+            luaL_setmetatable(L, "win32::memory");
+            buffer = 3;
+        }
+        else {
+            dst = (uint8_t*)check_address(L, 3);
+            luaL_argcheck(L, dst != nullptr, 3, "null pointer");
+            buffer = own_buffer(L, 3, dst);
+            luaL_argcheck(L, !buffer || structs_fit(n, size, (size_t)lua_rawlen(L, 3)), 3, "buffer too small");
+            lua_settop(L, 3);
+        }
+        if (!array) {
+            pack_struct(L, plan, 2, dst, buffer);
+            return 1;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            lua_rawgeti(L, 2, (lua_Integer)i + 1);
+            pack_struct(L, plan, -1, dst + i * size, buffer);
+            lua_pop(L, 1);
+        }
+        return 1;
+    }
+    // win32.unpack(type, mem [, count]): table of fields, or a sequence of count tables.
+    static int func_unpack(lua_State* L) {
+        auto plan = check_struct_plan(L, 1);
+        size_t size = struct_size(plan);
+        bool array = !lua_isnoneornil(L, 3);
+        lua_Integer count = array ? luaL_checkinteger(L, 3) : 1;
+        luaL_argcheck(L, count > 0 && count <= INT_MAX, 3, "invalid count");
+        size_t n = (size_t)count;
+        uint8_t const* src;
+        if (lua_type(L, 2) == LUA_TSTRING) {
+            size_t len = 0;
+            src = (uint8_t const*)lua_tolstring(L, 2, &len);
+            luaL_argcheck(L, structs_fit(n, size, len), 2, "struct too short");
+        }
+        else {
+            src = check_address(L, 2);
+            luaL_argcheck(L, src != nullptr, 2, "null pointer");
+            if (own_buffer(L, 2, src)) {
+                luaL_argcheck(L, structs_fit(n, size, (size_t)lua_rawlen(L, 2)), 2, "struct too short");
+            }
+            else {
+                luaL_argcheck(L, structs_fit(n, size, PTRDIFF_MAX), 3, "invalid count");
+            }
+        }
+        if (!array) {
+            unpack_struct(L, plan, src);
+            return 1;
+        }
+        lua_createtable(L, (int)n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            unpack_struct(L, plan, src + i * size);
+            lua_rawseti(L, -2, (lua_Integer)i + 1);
+        }
+        return 1;
+    }
+    // win32.struct(type [, init]): typed struct userdata, initialized like win32.pack.
+    static int func_struct(lua_State* L) {
+        auto plan = check_struct_plan(L, 1);
+        void* p = push_struct(L, plan);
+        if (!lua_isnoneornil(L, 2)) {
+            pack_struct(L, plan, 2, p, -1);
+        }
+        return 1;
+    }
+    // win32.callback_error(handler): handler(err) receives the errors raised by callbacks,
+    // which can't propagate through the native caller. nil restores the default (a Lua warning).
+    static int func_callback_error(lua_State* L) {
+        if (!lua_isnoneornil(L, 1)) {
+            luaL_checktype(L, 1, LUA_TFUNCTION);
+        }
+        lua_settop(L, 1);
+        lua_getfield(L, LUA_REGISTRYINDEX, "win32::callback_error");
+        lua_pushvalue(L, 1);
+        lua_setfield(L, LUA_REGISTRYINDEX, "win32::callback_error");
+        return 1;
+    }
+    static int func_dispatch_pending(lua_State* L) {
+        int max = (int)luaL_optinteger(L, 1, INT_MAX);
+        lua_pushinteger(L, dispatch_pending(L, max));
+        return 1;
+    }
+    static int func_enum_flags(lua_State* L) {
+        auto const& info = check_enum(L, 1);
+        uint64_t value = (uint64_t)luaL_checkinteger(L, 2);
+        lua_newtable(L);
+        // Values of a plain enum aren't bit sets, only an exact match names them.
+        if (value == 0 || !info.flags) {
+            if (auto e = info.find((int64_t)value)) {
+                lua_pushlstring(L, e->name.data(), e->name.size());
+                lua_rawseti(L, -2, 1);
+                value = 0;
+            }
+            lua_pushinteger(L, (lua_Integer)value);
+            return 2;
+        }
+        lua_Integer n = 0;
+        uint64_t rest = value;
+        for (auto const& e : info.by_bits) {
+            uint64_t bits = (uint64_t)e.value;
+            if ((value & bits) == bits && (rest & bits) != 0) {
+                lua_pushlstring(L, e.name.data(), e.name.size());
+                lua_rawseti(L, -2, ++n);
+                rest &= ~bits;
+                if (rest == 0) {
+                    break;
+                }
+            }
+        }
+        lua_pushinteger(L, (lua_Integer)rest);
+        return 2;
+    }
+    static int ns_apis_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto index = (const namespace_index*)lua_touserdata(L, lua_upvalueindex(2));
+        auto name = lua_checkstrview(L, 2);
+        auto it = index->apis.find(name);
+        if (it == index->apis.end()) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        bind_api(L, cache, it->second);
+        touched.record_api(name);
+        lua_pushvalue(L, -1);
+        lua_insert(L, 2);
+        lua_rawset(L, -4);
+        return 1;
+    }
+    static int ns_constants_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto index = (const namespace_index*)lua_touserdata(L, lua_upvalueindex(2));
+        auto name = lua_checkstrview(L, 2);
+        auto it = index->constants.find(name);
+        if (it == index->constants.end()) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        push_constant(L, cache, constant_value::decode(it->second));
+        touched.record_constant(name);
+        lua_pushvalue(L, -1);
+        lua_insert(L, 2);
+        lua_rawset(L, -4);
+        return 1;
+    }
+    static int ns_get(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        auto name = lua_checkstrview(L, 2);
+        auto index = raise_on_throw(L, [&] { return cache->find_namespace(name); });
+        if (!index) {
+            return luaL_error(L, "%s not found.", name.data());
+        }
+        struct {
+            const char* name;
+            lua_CFunction get;
+        } shards[] = {
+            { "apis", ns_apis_get },
+            { "constants", ns_constants_get },
+        };
+        lua_createtable(L, 0, 2);
+        for (auto const& shard : shards) {
+            lua_newtable(L);
+            lua_createtable(L, 0, 1);
+            lua_pushlightuserdata(L, (void*)cache);
+            lua_pushlightuserdata(L, (void*)index);
+            lua_pushcclosure(L, shard.get, 2);
+            lua_setfield(L, -2, "__index");
+            lua_setmetatable(L, -2);
+            lua_setfield(L, -2, shard.name);
+        }
+        lua_pushvalue(L, -1);
+        lua_insert(L, 2);
+        lua_rawset(L, -4);
+        return 1;
+    }
+    static int init_ns(lua_State* L, win32::cache const& cache) {
+        lua_newtable(L);
+        static luaL_Reg mt[] = {
+            { "__index", ns_get },
+            { NULL, NULL },
+        };
+        luaL_newlibtable(L, mt);
+        lua_pushlightuserdata(L, (void*)&cache);
+        luaL_setfuncs(L, mt, 1);
+        lua_setmetatable(L, -2);
+        return 1;
+    }
+    static bool warmup(lua_State* L, win32::cache const* cache, int apis_idx, int constants_idx, const char* path, preload_errors errors, bool async) {
+        std::vector<std::string> api_names;
+        std::vector<std::string> constant_names;
+        if (!access_profile::load(path, api_names, constant_names)) {
+            return false;
+        }
+        constants_idx = lua_absindex(L, constants_idx);
+        for (auto const& name : constant_names) {
+            if (auto constant = cache->find_constant(name)) {
+                lua_pushlstring(L, name.data(), name.size());
+                push_constant(L, cache, *constant);
+                lua_rawset(L, constants_idx);
+                touched.record_constant(name);
+            }
+        }
+        std::vector<ImplMap> apis;
+        apis.reserve(api_names.size());
+        for (auto const& name : api_names) {
+            if (auto api = cache->find_api(name)) {
+                apis.push_back(*api);
+                touched.record_api(api->ImportName());
+            }
+        }
+        preload_apis(L, cache, apis_idx, std::move(apis), errors, async);
+        return true;
+    }
+    static int func_warmup(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        const char* path = luaL_checkstring(L, 1);
+        if (!warmup(L, cache, lua_upvalueindex(2), lua_upvalueindex(3), path, preload_errors::skip, lua_toboolean(L, 2))) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s: can't open.", path);
+            return 2;
+        }
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+    // Lua literal of a numeric or boolean constant, 0 if the constant has no such form.
+    static int format_constant(constant_value const& value, char* buf, size_t sz) {
+        switch (value.type) {
+        case constant_value::kind::boolean:
+            return snprintf(buf, sz, value.payload ? "true" : "false");
+        case constant_value::kind::integer:
+            if (value.payload == (uint64_t)1 << 63) {
+                return snprintf(buf, sz, "0x8000000000000000");
+            }
+            return snprintf(buf, sz, "%lld", (long long)value.integer());
+        case constant_value::kind::number: {
+            double v = value.number();
+            if (v != v) {
+                return snprintf(buf, sz, "(0/0)");
+            }
+            if (v == HUGE_VAL || v == -HUGE_VAL) {
+                return snprintf(buf, sz, v > 0 ? "(1/0)" : "(-1/0)");
+            }
+            int len = snprintf(buf, sz, "%.17g", v);
+            if (!strpbrk(buf, ".eE")) {
+                len += snprintf(buf + len, sz - len, ".0");
+            }
+            return len;
+        }
+        default:
+            return 0;
+        }
+    }
+    struct dump_writer {
+        luaL_Buffer b;
+        bool init = false;
+        static int write(lua_State* L, const void* p, size_t sz, void* ud) {
+            auto& w = *(dump_writer*)ud;
+            if (!w.init) {
+                w.init = true;
+                luaL_buffinit(L, &w.b);
+            }
+            luaL_addlstring(&w.b, (const char*)p, sz);
+            return 0;
+        }
+    };
+    static int func_dump_constants(lua_State* L) {
+        auto cache = (const win32::cache*)lua_touserdata(L, lua_upvalueindex(1));
+        std::string_view prefix;
+        std::string_view ns;
+        if (!lua_isnoneornil(L, 1)) {
+            luaL_checktype(L, 1, LUA_TTABLE);
+            if (lua_getfield(L, 1, "prefix") != LUA_TNIL) {
+                prefix = lua_checkstrview(L, -1);
+            }
+            if (lua_getfield(L, 1, "namespace") != LUA_TNIL) {
+                ns = lua_checkstrview(L, -1);
+            }
+        }
+        namespace_index const* index = nullptr;
+        if (!ns.empty()) {
+            index = raise_on_throw(L, [&] { return cache->find_namespace(ns); });
+            if (!index) {
+                return luaL_error(L, "%s not found.", ns.data());
+            }
+        }
+        luaL_Buffer b;
+        luaL_buffinit(L, &b);
+        luaL_addstring(&b, "return {\n");
+        char buf[64];
+        auto add = [&](std::string_view const& name, constant_value const& value) {
+            if (name.substr(0, prefix.size()) != prefix) {
+                return;
+            }
+            int len = format_constant(value, buf, sizeof(buf));
+            if (len <= 0) {
+                return;
+            }
+            luaL_addstring(&b, "[\"");
+            luaL_addlstring(&b, name.data(), name.size());
+            luaL_addstring(&b, "\"]=");
+            luaL_addlstring(&b, buf, len);
+            luaL_addstring(&b, ",\n");
+        };
+        if (index) {
+            for (auto const& [name, field] : index->constants) {
+                if (field.Flags().Literal()) {
+                    add(name, constant_value::decode(field));
+                }
+            }
+        }
+        else {
+            for (auto const& [name, i] : cache->constants()) {
+                add(name, cache->constant(i));
+            }
+        }
+        luaL_addstring(&b, "}\n");
+        luaL_pushresult(&b);
+        size_t sz = 0;
+        const char* source = lua_tolstring(L, -1, &sz);
+        if (luaL_loadbuffer(L, source, sz, "=win32.constants") != LUA_OK) {
+            return lua_error(L);
+        }
+        dump_writer w;
+        lua_dump(L, dump_writer::write, &w, 1);
+        if (!w.init) {
+            return luaL_error(L, "unable to dump constants");
+        }
+        luaL_pushresult(&w.b);
+        return 1;
+    }
+    static int func_load_constants(lua_State* L) {
+        size_t sz = 0;
+        const char* chunk = luaL_checklstring(L, 1, &sz);
+        if (luaL_loadbufferx(L, chunk, sz, "=win32.constants", NULL) != LUA_OK) {
+            return lua_error(L);
+        }
+        lua_call(L, 0, 1);
+        luaL_checktype(L, -1, LUA_TTABLE);
+        lua_Integer n = 0;
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, lua_upvalueindex(1));
+            n++;
+        }
+        lua_pushinteger(L, n);
+        return 1;
+    }
+    // win32.record_profile(on): starts or stops recording the names save_profile writes, returns
+    // whether it was on.
+    static int func_record_profile(lua_State* L) {
+        lua_pushboolean(L, touched.enable(lua_toboolean(L, 1)));
+        return 1;
+    }
+    static int func_save_profile(lua_State* L) {
+        const char* path = luaL_checkstring(L, 1);
+        if (!touched.save(path)) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s: can't write.", path);
+            return 2;
+        }
+        lua_pushboolean(L, 1);
+        return 1;
+    }
     static int init_version(lua_State* L, win32::cache const& cache) {
         auto version = cache.database().Assembly[0].Version();
         lua_newtable(L);
@@ -186,21 +1037,179 @@ namespace win32 {
         m[i] = (uint8_t)v;
         return 0;
     }
+    // win32.string(ptr [, len]): bytes at an address, up to the NUL terminator when len is absent.
+    static int func_string(lua_State* L) {
+        auto p = (char const*)check_address(L, 1);
+        luaL_argcheck(L, p != nullptr, 1, "null pointer");
+        size_t len;
+        if (!lua_isnoneornil(L, 2)) {
+            lua_Integer n = luaL_checkinteger(L, 2);
+            luaL_argcheck(L, n >= 0, 2, "negative length");
+            len = (size_t)n;
+        }
+        else {
+            len = strlen(p);
+        }
+        lua_pushlstring(L, p, len);
+        return 1;
+    }
+    // win32.wstring(ptr [, len]): UTF-16 string at an address as UTF-8, len counted in UTF-16 units.
+    static int func_wstring(lua_State* L) {
+        auto p = (char16_t const*)check_address(L, 1);
+        luaL_argcheck(L, p != nullptr, 1, "null pointer");
+        size_t len;
+        if (!lua_isnoneornil(L, 2)) {
+            lua_Integer n = luaL_checkinteger(L, 2);
+            luaL_argcheck(L, n >= 0, 2, "negative length");
+            len = (size_t)n;
+        }
+        else {
+#if defined(_WIN32)
+            len = wcslen((wchar_t const*)p);
+#else
+            len = std::char_traits<char16_t>::length(p);
+#endif
+        }
+        auto str = cache::to_utf8({ p, len });
+        lua_pushlstring(L, str.data(), str.size());
+        return 1;
+    }
     static int func_memory(lua_State* L) {
         size_t sz = (size_t)luaL_checkinteger(L, 1);
-        lua_newuserdatauv(L, sz, 0);
+        lua_newuserdatauv(L, sz, 1);
+        luaL_setmetatable(L, "win32::memory");
+        return 1;
+    }
+    // Free buffers of one size class. User value 1 of the pool is the stack of free buffers; a pooled
+    // buffer keeps its pool in user value 2 and whether it is free in user value 3 (1 is the anchors
+    // of every win32.memory, see pack_struct).
+    struct memory_pool {
+        size_t size;
+        size_t max; // free buffers kept, the rest are left to the GC
+    };
+    // Returns buffer at idx to its pool. Plain win32.memory and already released buffers are ignored.
+    // A pooled buffer drops its anchors, so what was packed into it can be collected while it waits.
+    static void memory_release(lua_State* L, int idx) {
+        idx = lua_absindex(L, idx);
+        if (lua_getiuservalue(L, idx, 2) != LUA_TUSERDATA) {
+            lua_pop(L, 1);
+            return;
+        }
+        if (lua_getiuservalue(L, idx, 3) == LUA_TBOOLEAN && lua_toboolean(L, -1)) {
+            lua_pop(L, 2);
+            return;
+        }
+        lua_pop(L, 1);
+        auto pool = (memory_pool const*)lua_touserdata(L, -1);
+        lua_getiuservalue(L, -1, 1);
+        lua_Unsigned n = lua_rawlen(L, -1);
+        if (n < pool->max) {
+            lua_pushvalue(L, idx);
+            lua_rawseti(L, -2, (lua_Integer)n + 1);
+            lua_pushboolean(L, 1);
+            lua_setiuservalue(L, idx, 3);
+            lua_pushnil(L);
+            lua_setiuservalue(L, idx, 1);
+        }
+        lua_pop(L, 2);
+    }
+    static int memory_close(lua_State* L) {
+        memory_release(L, 1);
+        return 0;
+    }
+    // pool:acquire(): buffer of the pool's size class. Contents of a recycled buffer are left as they were.
+    static int pool_acquire(lua_State* L) {
+        auto pool = (memory_pool const*)luaL_checkudata(L, 1, "win32::pool");
+        lua_getiuservalue(L, 1, 1);
+        lua_Unsigned n = lua_rawlen(L, -1);
+        if (n > 0) {
+            lua_rawgeti(L, -1, (lua_Integer)n);
+            lua_pushnil(L);
+            lua_rawseti(L, -3, (lua_Integer)n);
+        }
+        else {
+            lua_newuserdatauv(L, pool->size, 3);
+            luaL_setmetatable(L, "win32::memory");
+            lua_pushvalue(L, 1);
+            lua_setiuservalue(L, -2, 2);
+        }
+        lua_pushboolean(L, 0);
+        lua_setiuservalue(L, -2, 3);
+        return 1;
+    }
+    // pool:release(buf): same as closing buf.
+    static int pool_release(lua_State* L) {
+        luaL_checkudata(L, 1, "win32::pool");
+        luaL_checkudata(L, 2, "win32::memory");
+        lua_getiuservalue(L, 2, 2);
+        luaL_argcheck(L, lua_rawequal(L, 1, -1), 2, "buffer of another pool");
+        lua_pop(L, 1);
+        memory_release(L, 2);
+        return 0;
+    }
+    // pool:clear(): drops the free buffers.
+    static int pool_clear(lua_State* L) {
+        luaL_checkudata(L, 1, "win32::pool");
+        lua_newtable(L);
+        lua_setiuservalue(L, 1, 1);
+        return 0;
+    }
+    // win32.pool(size [, max]): pool of buffers of at least size bytes, rounded up to a power of two.
+    // One pool per size class and lua_State; max (default 16) bounds the free buffers it keeps.
+    // Buffers stay ordinary win32::memory blocks on the Lua heap, large ones included: allocating
+    // them outside it with external-size accounting was declined, as Lua 5.4 has no API for that.
+    static int func_pool(lua_State* L) {
+        lua_Integer request = luaL_checkinteger(L, 1);
+        luaL_argcheck(L, request > 0 && (lua_Unsigned)request <= (SIZE_MAX >> 1), 1, "invalid size");
+        size_t size = 16;
+        while (size < (size_t)request) {
+            size <<= 1;
+        }
+        luaL_getsubtable(L, LUA_REGISTRYINDEX, "win32::pools");
+        if (lua_rawgeti(L, -1, (lua_Integer)size) != LUA_TUSERDATA) {
+            lua_pop(L, 1);
+            auto pool = (memory_pool*)lua_newuserdatauv(L, sizeof(memory_pool), 1);
+            pool->size = size;
+            pool->max = 16;
+            lua_newtable(L);
+            lua_setiuservalue(L, -2, 1);
+            luaL_setmetatable(L, "win32::pool");
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, -3, (lua_Integer)size);
+        }
+        if (!lua_isnoneornil(L, 2)) {
+            lua_Integer max = luaL_checkinteger(L, 2);
+            luaL_argcheck(L, max >= 0, 2, "negative max");
+            auto pool = (memory_pool*)lua_touserdata(L, -1);
+            pool->max = (size_t)max;
+        }
+        return 1;
+    }
+    // Registered at load time: struct results are win32::memory buffers too.
+    static void init_memory(lua_State* L) {
         if (luaL_newmetatable(L, "win32::memory")) {
             luaL_Reg l[] = {
                 { "__tostring", memory_tostring },
                 { "__len", memory_size},
                 { "__index", memory_read },
                 { "__newindex", memory_write },
+                { "__close", memory_close },
                 { NULL, NULL },
             };
             luaL_setfuncs(L, l, 0);
         }
-        lua_setmetatable(L, -2);
-        return 1;
+        lua_pop(L, 1);
+        if (luaL_newmetatable(L, "win32::pool")) {
+            luaL_Reg l[] = {
+                { "acquire", pool_acquire },
+                { "release", pool_release },
+                { "clear", pool_clear },
+                { NULL, NULL },
+            };
+            luaL_newlib(L, l);
+            lua_setfield(L, -2, "__index");
+        }
+        lua_pop(L, 1);
     }
     static int open(lua_State* L) {
         try {
@@ -211,9 +1220,19 @@ namespace win32 {
             } init[] = {
                 { "apis", init_apis },
                 { "constants", init_constants },
+                { "enums", init_enums },
+                { "ns", init_ns },
                 { "version", init_version },
                 { NULL, NULL },
             };
+            init_memory(L);
+            background_preloads();
+            lua_newuserdatauv(L, 0, 0);
+            lua_createtable(L, 0, 1);
+            lua_pushcfunction(L, preload_join);
+            lua_setfield(L, -2, "__gc");
+            lua_setmetatable(L, -2);
+            lua_setfield(L, LUA_REGISTRYINDEX, "win32::preload");
             lua_newtable(L);
             for (auto l = init; l->name != NULL; l++) {
                 l->func(L, db);
@@ -221,9 +1240,58 @@ namespace win32 {
             }
             luaL_Reg func[] = {
                 { "memory", func_memory },
+                { "pool", func_pool },
+                { "string", func_string },
+                { "wstring", func_wstring },
+                { "record_profile", func_record_profile },
+                { "save_profile", func_save_profile },
+                { "dispatch_pending", func_dispatch_pending },
+                { "callback_error", func_callback_error },
                 {NULL, NULL},
             };
             luaL_setfuncs(L, func, 0);
+            luaL_Reg cache_func[] = {
+                { "dump_constants", func_dump_constants },
+                { "enum_name", func_enum_name },
+                { "enum_flags", func_enum_flags },
+                { "callback", func_callback },
+                { "interface", func_interface },
+                { "cast_fn", func_cast_fn },
+                { "pack", func_pack },
+                { "unpack", func_unpack },
+                { "struct", func_struct },
+                {NULL, NULL},
+            };
+            lua_pushlightuserdata(L, (void*)&db);
+            luaL_setfuncs(L, cache_func, 1);
+            luaL_Reg apis_func[] = {
+                { "preload", func_preload },
+                { "preload_namespace", func_preload_namespace },
+                {NULL, NULL},
+            };
+            lua_pushlightuserdata(L, (void*)&db);
+            lua_getfield(L, -2, "apis");
+            luaL_setfuncs(L, apis_func, 2);
+            lua_pushlightuserdata(L, (void*)&db);
+            lua_getfield(L, -2, "apis");
+            lua_getfield(L, -3, "constants");
+            lua_pushcclosure(L, func_warmup, 3);
+            lua_setfield(L, -2, "warmup");
+            lua_getfield(L, -1, "constants");
+            lua_pushcclosure(L, func_load_constants, 1);
+            lua_setfield(L, -2, "load_constants");
+            if (const char* path = getenv("LUAWIN32_PROFILE")) {
+                touched.enable(true);
+                lua_getfield(L, -1, "apis");
+                lua_getfield(L, -2, "constants");
+                // A stale profile must not make require fail, report its problems as warnings.
+                if (!warmup(L, &db, -2, -1, path, preload_errors::warn, getenv("LUAWIN32_PROFILE_ASYNC") != NULL)) {
+                    lua_warning(L, "win32 warmup: ", 1);
+                    lua_warning(L, path, 1);
+                    lua_warning(L, ": can't open.", 0);
+                }
+                lua_pop(L, 2);
+            }
             return 1;
         } catch (std::exception const& e) {
             return luaL_error(L, "%s", e.what());
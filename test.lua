@@ -2,6 +2,11 @@ local win32 = require "win32"
 local apis = win32.apis
 local c = win32.constants
 
+dofile "test/struct_call.lua"
+dofile "test/struct_pack.lua"
+dofile "test/struct_members.lua"
+dofile "test/interface.lua"
+
 local function u2w(str)
     local wlen = apis.MultiByteToWideChar(c.CP_UTF8, 0, str, #str, nil, 0)
     local wstr = win32.memory((wlen+1)*2)
@@ -0,0 +1,79 @@
+// Foreign-thread callbacks through call_queue: 1 to max_producers threads post (queued mode)
+// or send (blocking mode) calls while the owner thread drains them, as dispatch_pending does.
+// Reports calls per second for each producer count.
+//
+//   bench_call_queue [max_producers] [calls_per_producer]
+#include "../src/mpsc.h"
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+static void discard(win32::pending_call* call) {
+    delete call;
+}
+
+static double run(int producers, uintptr_t calls, bool blocking) {
+    win32::call_queue q(discard);
+    std::atomic<int> finished { 0 };
+    std::atomic<bool> go { false };
+    std::vector<std::thread> pool;
+    for (int p = 0; p < producers; ++p) {
+        pool.emplace_back([&] {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            for (uintptr_t i = 0; i < calls; ++i) {
+                if (blocking) {
+                    win32::pending_call call;
+                    call.args[0] = i;
+                    q.send(call);
+                }
+                else {
+                    auto call = new win32::pending_call;
+                    call->args[0] = i;
+                    q.post(call);
+                }
+            }
+            ++finished;
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    uintptr_t total = producers * calls;
+    uintptr_t checksum = 0;
+    for (uintptr_t done = 0; done < total;) {
+        if (auto call = q.pop()) {
+            checksum += call->args[0];
+            call->result = checksum;
+            q.complete(call);
+            ++done;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& t : pool) {
+        t.join();
+    }
+    if (checksum != producers * (calls * (calls - 1) / 2)) {
+        fprintf(stderr, "lost calls\n");
+        exit(1);
+    }
+    return total / seconds;
+}
+
+int main(int argc, char** argv) {
+    int max_producers = argc > 1 ? atoi(argv[1]) : 16;
+    uintptr_t calls = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+    printf("%9s %16s %16s\n", "producers", "queued calls/s", "blocking calls/s");
+    for (int p = 1; p <= max_producers; p *= 2) {
+        double queued = run(p, calls, false);
+        double blocking = run(p, calls / 10 + 1, true);
+        printf("%9d %16.0f %16.0f\n", p, queued, blocking);
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+// N threads x M lazily filled maps, the access pattern of win32::cache: mostly hits,
+// a few cold misses that build an entry and insert it. Compares one reader/writer
+// lock shared by all maps against one lock per map (lazy_map).
+//
+//   bench_lazy_map [max_threads] [maps] [ops_per_thread]
+#include "../src/lazy_map.h"
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t prefilled = 4096;
+constexpr uint32_t miss_every = 64; // one lookup in 64 asks for a key nobody built yet
+
+// The layout cache.h had before: every map behind the same lock.
+class single_lock_maps {
+public:
+    explicit single_lock_maps(size_t n)
+        : m_maps(n)
+    {}
+    uint64_t const* find(size_t map, uint32_t key) const {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        auto it = m_maps[map].find(key);
+        return it == m_maps[map].end() ? nullptr : &it->second;
+    }
+    uint64_t const& insert(size_t map, uint32_t key, uint64_t value) {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        return m_maps[map].try_emplace(key, value).first->second;
+    }
+private:
+    mutable std::shared_mutex m_mutex;
+    std::vector<std::map<uint32_t, uint64_t>> m_maps;
+};
+
+class split_lock_maps {
+public:
+    explicit split_lock_maps(size_t n)
+        : m_maps(n)
+    {}
+    uint64_t const* find(size_t map, uint32_t key) const {
+        return m_maps[map].find(key);
+    }
+    uint64_t const& insert(size_t map, uint32_t key, uint64_t value) {
+        return m_maps[map].insert(key, std::move(value));
+    }
+private:
+    std::vector<win32::lazy_map<uint32_t, uint64_t>> m_maps;
+};
+
+static uint64_t build(uint32_t key) {
+    // Stand-in for decoding a blob or laying out a struct.
+    uint64_t v = key;
+    for (int i = 0; i < 64; ++i) {
+        v = v * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return v;
+}
+
+template <typename Maps>
+static double run(size_t threads, size_t maps, uint32_t ops) {
+    Maps m(maps);
+    for (size_t i = 0; i < maps; ++i) {
+        for (uint32_t k = 0; k < prefilled; ++k) {
+            m.insert(i, k, build(k));
+        }
+    }
+    std::atomic<uint32_t> next_miss { prefilled };
+    std::atomic<bool> go { false };
+    std::atomic<uint64_t> checksum { 0 };
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t sum = 0;
+            uint32_t x = (uint32_t)t * 2654435761u + 1;
+            for (uint32_t i = 0; i < ops; ++i) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                size_t map = (t + i) % maps;
+                uint32_t key = (i % miss_every == 0) ? next_miss.fetch_add(1, std::memory_order_relaxed) : x % prefilled;
+                auto v = m.find(map, key);
+                sum += v ? *v : m.insert(map, key, build(key));
+            }
+            checksum += sum;
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : pool) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (checksum.load() == 42) {
+        printf("\n"); // keep the work observable
+    }
+    return threads * (double)ops / elapsed.count() / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    size_t max_threads = argc > 1 ? (size_t)atoi(argv[1]) : 16;
+    size_t maps = argc > 2 ? (size_t)atoi(argv[2]) : 8;
+    uint32_t ops = argc > 3 ? (uint32_t)atoi(argv[3]) : 200000;
+    printf("hardware threads: %u, maps: %zu, lookups per thread: %u\n", std::thread::hardware_concurrency(), maps, ops);
+    printf("%8s %16s %16s\n", "threads", "single (M/s)", "split (M/s)");
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+        double single = run<single_lock_maps>(n, maps, ops);
+        double split = run<split_lock_maps>(n, maps, ops);
+        printf("%8zu %16.2f %16.2f\n", n, single, split);
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Whole-table joins of a parent-keyed table (Constant, CustomAttribute...) against its parents,
+// the passes win32::cache runs when it loads. The child table is sorted by parent, as winmd
+// requires; parents and rows are plain integers, since a real table needs a .winmd file.
+// Compares one binary search per parent (equal_range, what the row accessors do) with the
+// merge cursor of parent_cursor and the grouping scan of for_each_parent, both O(n).
+//
+//   bench_parent_cursor [max_parents] [rows_per_parent] [runs]
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// Every other parent has rows, like fields of which only some carry a constant.
+static std::vector<uint32_t> make_rows(uint32_t parents, uint32_t per_parent) {
+    std::vector<uint32_t> rows;
+    rows.reserve((size_t)parents / 2 * per_parent);
+    for (uint32_t p = 0; p < parents; p += 2) {
+        rows.insert(rows.end(), per_parent, p);
+    }
+    return rows;
+}
+
+static uint64_t join_equal_range(std::vector<uint32_t> const& rows, uint32_t parents) {
+    uint64_t sum = 0;
+    for (uint32_t p = 0; p < parents; ++p) {
+        auto range = std::equal_range(rows.begin(), rows.end(), p);
+        sum += (uint64_t)(range.second - range.first) * p;
+    }
+    return sum;
+}
+
+// parent_cursor::seek
+static uint64_t join_cursor(std::vector<uint32_t> const& rows, uint32_t parents) {
+    uint64_t sum = 0;
+    auto current = rows.begin();
+    auto const last = rows.end();
+    for (uint32_t p = 0; p < parents; ++p) {
+        while (current != last && *current < p) {
+            ++current;
+        }
+        auto const first = current;
+        while (current != last && !(p < *current)) {
+            ++current;
+        }
+        sum += (uint64_t)(current - first) * p;
+    }
+    return sum;
+}
+
+// for_each_parent
+static uint64_t join_groups(std::vector<uint32_t> const& rows, uint32_t) {
+    uint64_t sum = 0;
+    auto const last = rows.end();
+    for (auto first = rows.begin(); first != last;) {
+        auto const parent = *first;
+        auto next = first + 1;
+        while (next != last && *next == parent) {
+            ++next;
+        }
+        sum += (uint64_t)(next - first) * parent;
+        first = next;
+    }
+    return sum;
+}
+
+template <typename Join>
+static double run(Join join, std::vector<uint32_t> const& rows, uint32_t parents, int runs, uint64_t& checksum) {
+    double total = 0;
+    for (int i = 0; i < runs; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        checksum += join(rows, parents);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        total += elapsed.count();
+    }
+    return total / runs;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t max_parents = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+    uint32_t per_parent = argc > 2 ? (uint32_t)atoi(argv[2]) : 3;
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+    printf("rows per parent with rows: %u, mean of %d runs\n", per_parent, runs);
+    printf("%10s %10s %18s %14s %14s\n", "parents", "rows", "equal_range (ms)", "cursor (ms)", "groups (ms)");
+    uint64_t checksum = 0;
+    for (uint32_t parents = 10000; parents <= max_parents; parents *= 10) {
+        auto rows = make_rows(parents, per_parent);
+        double searched = run(join_equal_range, rows, parents, runs, checksum);
+        double cursor = run(join_cursor, rows, parents, runs, checksum);
+        double groups = run(join_groups, rows, parents, runs, checksum);
+        printf("%10u %10zu %18.2f %14.2f %14.2f\n", parents, rows.size(), searched, cursor, groups);
+    }
+    if (checksum == 42) {
+        printf("\n"); // keep the work observable
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+-- A COM object faked from Lua callbacks. Its methods are called through the vtable by
+-- win32.interface and by shlwapi, which receives the interface object as an IUnknown parameter
+-- and must see the COM pointer, not the address of the Lua userdata.
+local win32 = require "win32"
+local apis = win32.apis
+
+local refs = 0
+local seen = {}
+local function method(delta)
+    return function (this)
+        seen[#seen + 1] = win32.unpack("HWND", this).Value
+        refs = refs + delta
+        return refs
+    end
+end
+local add_ref_cb, add_ref = win32.callback("LPTHREAD_START_ROUTINE", method(1))
+local release_cb, release = win32.callback("LPTHREAD_START_ROUTINE", method(-1))
+-- The callback userdata above keep the entries alive; QueryInterface is never called.
+local vtbl = win32.pack("HWND", { {}, { Value = add_ref }, { Value = release } })
+local object = win32.pack("HWND", { Value = vtbl })
+local vtbl_address = win32.unpack("HWND", object).Value
+
+local unk = win32.interface("IUnknown", object)
+assert(unk:AddRef() == 1)
+assert(unk:Release() == 0)
+
+local slot = win32.pack("HWND", {})
+apis.IUnknown_Set(slot, unk)
+assert(refs == 1)
+local object_address = win32.unpack("HWND", win32.pack("HWND", { Value = object })).Value
+assert(win32.unpack("HWND", slot).Value == object_address)
+apis.IUnknown_AtomicRelease(slot)
+assert(refs == 0)
+
+assert(#seen == 4)
+for _, v in ipairs(seen) do
+    assert(v == vtbl_address)
+end
+print "interface: ok"
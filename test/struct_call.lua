@@ -0,0 +1,42 @@
+-- Structs crossing calls: out pointers, by-value parameters, results in a register and
+-- results through the hidden pointer of a COM method.
+local win32 = require "win32"
+local apis = win32.apis
+
+-- [Out] POINT*: the api writes into a win32.struct.
+local pt = win32.struct "POINT"
+assert(apis.GetCursorPos(pt) ~= 0)
+assert(math.type(pt.x) == "integer" and math.type(pt.y) == "integer")
+
+-- POINT by value, next to RECT by pointer.
+local rc = win32.struct("RECT", { left = 10, top = 20, right = 30, bottom = 40 })
+assert(apis.PtInRect(rc, win32.pack("POINT", { x = 15, y = 25 })) ~= 0)
+assert(apis.PtInRect(rc, win32.struct("POINT", { x = 5, y = 25 })) == 0)
+
+-- COORD (4 bytes) comes back in a register, as a typed struct.
+local size = apis.GetLargestConsoleWindowSize(apis.GetStdHandle(-11)) -- STD_OUTPUT_HANDLE
+assert(#size == 4)
+assert(math.type(size.X) == "integer" and math.type(size.Y) == "integer")
+
+-- A COM method returns even an 8 byte struct through a pointer after `this`. The fake heap's
+-- vtable entry has the native shape (this, result) and fills the result.
+local this_seen
+local handle_cb, get_handle = win32.callback("WNDENUMPROC", function (this, result)
+    this_seen = this
+    win32.pack("D3D12_CPU_DESCRIPTOR_HANDLE", { ptr = 0x1234 }, result)
+    return result
+end)
+local slots = {}
+for i = 1, 11 do
+    slots[i] = {}
+end
+slots[10] = { Value = get_handle } -- GetCPUDescriptorHandleForHeapStart, after IUnknown, ID3D12Object and ID3D12DeviceChild
+local vtbl = win32.pack("HWND", slots)
+local object = win32.pack("HWND", { Value = vtbl })
+local heap = win32.interface("ID3D12DescriptorHeap", object)
+local h = heap:GetCPUDescriptorHandleForHeapStart()
+assert(h.ptr == 0x1234)
+assert(this_seen == win32.unpack("HWND", win32.pack("HWND", { Value = object })).Value)
+assert(handle_cb) -- kept alive until here
+
+print "struct_call: ok"
@@ -0,0 +1,35 @@
+-- win32.struct members: bitfields, anonymous unions, and nested structs read as views.
+local win32 = require "win32"
+
+-- DCB packs its flags into one DWORD.
+local dcb = win32.struct "DCB"
+dcb.fBinary = 1
+dcb.fDtrControl = 2
+assert(dcb.fBinary == 1 and dcb.fDtrControl == 2 and dcb.fParity == 0)
+dcb.fDtrControl = 7 -- two bits wide
+assert(dcb.fDtrControl == 3 and dcb.fBinary == 1)
+local t = win32.unpack("DCB", dcb)
+assert(t.fDtrControl == 3 and t.fBinary == 1)
+
+-- LARGE_INTEGER: the anonymous struct's members are flattened over QuadPart, `u` is a view.
+local li = win32.struct "LARGE_INTEGER"
+li.QuadPart = 0x100000002
+assert(li.LowPart == 2 and li.HighPart == 1)
+li.u.HighPart = 5
+assert(li.QuadPart == 0x500000002)
+li.QuadPart = -1
+assert(li.HighPart == -1 and li.LowPart == 0xFFFFFFFF)
+
+-- Writes through a nested member land in the parent, which the view keeps alive.
+local ps = win32.struct "PAINTSTRUCT"
+ps.rcPaint.left = 5
+assert(ps.rcPaint.left == 5)
+assert(win32.unpack("PAINTSTRUCT", ps).rcPaint.left == 5)
+local rc = ps.rcPaint
+ps = nil
+collectgarbage()
+rc.right = 9
+assert(rc.left == 5 and rc.right == 9 and #rc == 16)
+assert(win32.unpack("RECT", rc).right == 9)
+
+print "struct_members: ok"
@@ -0,0 +1,36 @@
+-- win32.pack and win32.unpack: round trips, arrays, count checks, and strings in pointer fields.
+local win32 = require "win32"
+
+local r = win32.pack("RECT", { left = 1, top = -2, right = 30, bottom = 40 })
+assert(#r == 16)
+local t = win32.unpack("RECT", r)
+assert(t.left == 1 and t.top == -2 and t.right == 30 and t.bottom == 40)
+-- A string is taken as the raw struct bytes.
+t = win32.unpack("RECT", tostring(r))
+assert(t.left == 1 and t.bottom == 40)
+
+local points = win32.pack("POINT", { { x = 1, y = 2 }, { x = 3, y = 4 } })
+assert(#points == 16)
+local list = win32.unpack("POINT", points, 2)
+assert(#list == 2 and list[1].x == 1 and list[2].y == 4)
+assert(not pcall(win32.unpack, "POINT", points, 3))
+assert(not pcall(win32.unpack, "POINT", points, 0))
+assert(not pcall(win32.unpack, "POINT", points, -1))
+assert(not pcall(win32.unpack, "POINT", points, math.maxinteger))
+assert(not pcall(win32.pack, "POINT", { { x = 1 }, { x = 2 }, { x = 3 } }, win32.memory(16)))
+
+-- A buffer keeps the string its pointer field points into.
+local function address(v)
+    return win32.unpack("HWND", win32.pack("HWND", { Value = v })).Value
+end
+local text = ("x"):rep(40) .. "!"
+local holder = win32.pack("HWND", { Value = text })
+text = nil
+collectgarbage()
+assert(win32.string(win32.unpack("HWND", holder).Value) == ("x"):rep(40) .. "!")
+-- Foreign memory can't keep it, so it is refused.
+local raw = win32.memory(8)
+assert(not pcall(win32.pack, "HWND", { Value = "str" }, address(raw)))
+assert(pcall(win32.pack, "HWND", { Value = "str" }, raw))
+
+print "struct_pack: ok"
@@ -0,0 +1,179 @@
+// call_queue under many producers: per-producer order of posted calls, blocking sends,
+// dropping the calls of one target, and closing while producers are still running.
+// Meant to be run under ThreadSanitizer and AddressSanitizer as well.
+#include "../src/mpsc.h"
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+using namespace win32;
+
+static int failures = 0;
+
+#define CHECK(expr) \
+    do { if (!(expr)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); ++failures; } } while (0)
+
+static std::atomic<int> live_calls { 0 };
+
+static pending_call* new_call(void* target, uintptr_t a, uintptr_t b) {
+    auto call = new pending_call;
+    call->target = target;
+    call->args[0] = a;
+    call->args[1] = b;
+    ++live_calls;
+    return call;
+}
+
+static void discard(pending_call* call) {
+    --live_calls;
+    delete call;
+}
+
+static void test_post_order() {
+    constexpr int producers = 8;
+    constexpr uintptr_t calls = 5000;
+    call_queue q(discard);
+    std::vector<std::thread> pool;
+    for (int p = 0; p < producers; ++p) {
+        pool.emplace_back([&q, p] {
+            for (uintptr_t i = 0; i < calls; ++i) {
+                q.post(new_call(nullptr, p, i));
+            }
+        });
+    }
+    std::vector<uintptr_t> next(producers);
+    uintptr_t seen = 0;
+    while (seen < producers * calls) {
+        auto call = q.pop();
+        if (!call) {
+            std::this_thread::yield();
+            continue;
+        }
+        auto p = call->args[0];
+        CHECK(p < producers && call->args[1] == next[p]);
+        next[p] = call->args[1] + 1;
+        q.complete(call);
+        ++seen;
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    CHECK(q.pop() == nullptr);
+    CHECK(live_calls.load() == 0);
+}
+
+static void test_send() {
+    constexpr int producers = 8;
+    constexpr uintptr_t calls = 500;
+    call_queue q(discard);
+    std::atomic<int> errors { 0 };
+    std::atomic<int> finished { 0 };
+    std::vector<std::thread> pool;
+    for (int p = 0; p < producers; ++p) {
+        pool.emplace_back([&, p] {
+            for (uintptr_t i = 0; i < calls; ++i) {
+                pending_call call;
+                call.args[0] = p;
+                call.args[1] = i;
+                if (!q.send(call) || call.result != p * 1000 + i) {
+                    ++errors;
+                }
+            }
+            ++finished;
+        });
+    }
+    while (finished.load() < producers) {
+        if (auto call = q.pop()) {
+            call->result = call->args[0] * 1000 + call->args[1];
+            q.complete(call);
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    CHECK(errors.load() == 0);
+}
+
+static void test_drop() {
+    int a, b;
+    call_queue q(discard);
+    for (uintptr_t i = 0; i < 10; ++i) {
+        q.post(new_call(i % 2 ? &a : &b, i, 0));
+    }
+    q.drop_if([&](pending_call const& call) { return call.target == &a; });
+    CHECK(live_calls.load() == 5);
+    for (uintptr_t i = 0; i < 10; i += 2) {
+        auto call = q.pop();
+        CHECK(call && call->target == &b && call->args[0] == i);
+        if (call) {
+            q.complete(call);
+        }
+    }
+    CHECK(q.pop() == nullptr);
+    CHECK(live_calls.load() == 0);
+}
+
+static void test_close_during_produce() {
+    // Producers share ownership like callbacks do; the owner closes and lets go of its
+    // reference while they are still posting and sending.
+    constexpr int producers = 6;
+    for (int round = 0; round < 20; ++round) {
+        auto q = std::make_shared<call_queue>(discard);
+        std::atomic<int> refused { 0 };
+        std::vector<std::thread> pool;
+        for (int p = 0; p < producers; ++p) {
+            pool.emplace_back([q, p, &refused] {
+                for (uintptr_t i = 0;; ++i) {
+                    if (p % 2) {
+                        pending_call call;
+                        call.result = 1;
+                        if (!q->send(call)) {
+                            break;
+                        }
+                    }
+                    else {
+                        auto call = new_call(nullptr, p, i);
+                        if (!q->post(call)) {
+                            discard(call);
+                            break;
+                        }
+                    }
+                }
+                ++refused;
+            });
+        }
+        for (int i = 0; i < 200; ++i) {
+            if (auto call = q->pop()) {
+                q->complete(call);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+        q->close();
+        q.reset();
+        for (auto& t : pool) {
+            t.join();
+        }
+        CHECK(refused.load() == producers);
+        CHECK(live_calls.load() == 0);
+    }
+}
+
+int main() {
+    test_post_order();
+    test_send();
+    test_drop();
+    test_close_during_produce();
+    if (failures) {
+        fprintf(stderr, "%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("test_call_queue: ok\n");
+    return 0;
+}
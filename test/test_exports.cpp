@@ -0,0 +1,170 @@
+// Builds a small PE32+ image in memory and checks export_table against it,
+// both as a file on disk (section offsets) and as a loader-mapped image.
+#include "../src/exports.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace winmd;
+
+static int failures = 0;
+
+#define CHECK(expr) \
+    do { if (!(expr)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); ++failures; } } while (0)
+
+// Layout of the fixture's only section (.edata at RVA 0x1000, file offset 0x200):
+//   0x1000 export directory, 0x1040 functions, 0x1050 names, 0x1060 ordinals,
+//   0x1070 strings (module name, export names, forwarder). The directory spans
+//   0x1000-0x10A0 so the forwarder string lies inside it.
+constexpr uint32_t section_rva = 0x1000;
+constexpr uint32_t section_offset = 0x200;
+constexpr uint32_t section_size = 0x200;
+constexpr uint32_t directory_size = 0xA0;
+
+struct fixture {
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> mapped;
+};
+
+template <typename T>
+static T& at(std::vector<uint8_t>& image, uint32_t offset) {
+    return *(T*)(image.data() + offset);
+}
+
+static uint32_t put_string(std::vector<uint8_t>& image, uint32_t& rva, char const* str) {
+    uint32_t start = rva;
+    size_t len = strlen(str) + 1;
+    memcpy(image.data() + section_offset + (rva - section_rva), str, len);
+    rva += (uint32_t)len;
+    return start;
+}
+
+static fixture make_fixture() {
+    std::vector<uint8_t> image(section_offset + section_size);
+    auto& dos = at<impl::image_dos_header>(image, 0);
+    dos.e_signature = 0x5A4D;
+    dos.e_lfanew = sizeof(impl::image_dos_header);
+    auto& nt = at<impl::image_nt_headers32plus>(image, dos.e_lfanew);
+    nt.Signature = 0x00004550;
+    nt.FileHeader.Machine = 0x8664;
+    nt.FileHeader.NumberOfSections = 1;
+    nt.FileHeader.SizeOfOptionalHeader = sizeof(impl::image_optional_header32plus);
+    nt.OptionalHeader.Magic = 0x20B;
+    nt.OptionalHeader.SectionAlignment = 0x1000;
+    nt.OptionalHeader.FileAlignment = 0x200;
+    nt.OptionalHeader.SizeOfImage = section_rva + 0x1000;
+    nt.OptionalHeader.SizeOfHeaders = section_offset;
+    nt.OptionalHeader.NumberOfRvaAndSizes = 16;
+    nt.OptionalHeader.DataDirectory[0] = { section_rva, directory_size };
+    auto& section = at<impl::image_section_header>(image, dos.e_lfanew + sizeof(impl::image_nt_headers32plus));
+    memcpy(section.Name, ".edata", 6);
+    section.Misc.VirtualSize = section_size;
+    section.VirtualAddress = section_rva;
+    section.SizeOfRawData = section_size;
+    section.PointerToRawData = section_offset;
+
+    auto file_offset = [](uint32_t rva) { return section_offset + (rva - section_rva); };
+    uint32_t strings = 0x1070;
+    auto& exports = at<impl::image_export_directory>(image, file_offset(section_rva));
+    exports.Name = put_string(image, strings, "fixture.dll");
+    exports.Base = 1;
+    exports.NumberOfFunctions = 4;
+    exports.NumberOfNames = 3;
+    exports.AddressOfFunctions = 0x1040;
+    exports.AddressOfNames = 0x1050;
+    exports.AddressOfNameOrdinals = 0x1060;
+
+    uint32_t names[3] = {
+        put_string(image, strings, "alpha"),
+        put_string(image, strings, "beta"),
+        put_string(image, strings, "forwarded"),
+    };
+    uint32_t functions[4] = {
+        0x1100,                                         // alpha
+        0x1110,                                         // beta
+        put_string(image, strings, "OTHER.target"),     // forwarded: points into the directory
+        0x1120,                                         // ordinal 4, no name
+    };
+    uint16_t ordinals[3] = { 0, 1, 2 };
+    memcpy(image.data() + file_offset(exports.AddressOfFunctions), functions, sizeof functions);
+    memcpy(image.data() + file_offset(exports.AddressOfNames), names, sizeof names);
+    memcpy(image.data() + file_offset(exports.AddressOfNameOrdinals), ordinals, sizeof ordinals);
+    if (strings > section_rva + directory_size) {
+        fprintf(stderr, "fixture strings overflow the export directory\n");
+        exit(1);
+    }
+
+    fixture f;
+    f.mapped.resize(nt.OptionalHeader.SizeOfImage);
+    memcpy(f.mapped.data(), image.data(), section_offset);
+    memcpy(f.mapped.data() + section_rva, image.data() + section_offset, section_size);
+    f.file = std::move(image);
+    return f;
+}
+
+static void check_table(win32::export_table const& table) {
+    CHECK(table.find("alpha") == 0x1100);
+    CHECK(table.find("beta") == 0x1110);
+    CHECK(table.find("forwarded") == 0);
+    CHECK(table.find("missing") == 0);
+    CHECK(table.find("") == 0);
+    CHECK(table.size() == 2);
+}
+
+int main() {
+    auto f = make_fixture();
+    reader::byte_view file { f.file.data(), f.file.data() + f.file.size() };
+    check_table(win32::export_table { file, false });
+
+    check_table(win32::export_table { win32::export_table::loaded_image(f.mapped.data()), true });
+
+    // Out-of-range name ordinals are skipped rather than read past the function array.
+    auto bad = f.file;
+    at<uint16_t>(bad, section_offset + 0x60 + 2) = 7;
+    reader::byte_view bad_view { bad.data(), bad.data() + bad.size() };
+    win32::export_table table { bad_view, false };
+    CHECK(table.find("alpha") == 0x1100);
+    CHECK(table.find("beta") == 0);
+
+    // A broken signature is reported, not parsed.
+    bad = f.file;
+    at<uint16_t>(bad, 0) = 0;
+    bool threw = false;
+    try {
+        win32::export_table { reader::byte_view { bad.data(), bad.data() + bad.size() }, false };
+    }
+    catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // A section count running past the end of the image is reported before the table is walked.
+    bad = f.file;
+    at<impl::image_nt_headers32plus>(bad, sizeof(impl::image_dos_header)).FileHeader.NumberOfSections = 0xFFFF;
+    threw = false;
+    try {
+        win32::export_table { reader::byte_view { bad.data(), bad.data() + bad.size() }, false };
+    }
+    catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // So is an e_lfanew that would wrap the 32-bit offsets of byte_view.
+    bad = f.file;
+    at<impl::image_dos_header>(bad, 0).e_lfanew = -8;
+    threw = false;
+    try {
+        win32::export_table { reader::byte_view { bad.data(), bad.data() + bad.size() }, false };
+    }
+    catch (std::invalid_argument const&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    if (failures) {
+        fprintf(stderr, "%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("test_exports: ok\n");
+    return 0;
+}
@@ -0,0 +1,215 @@
+// Thunk pool against a C library taking callbacks (qsort), pool growth and exhaustion,
+// concurrent acquire/release, and retiring an entry while calls are running through it.
+// Builds on any platform: the pool has no Windows dependency.
+#include "../src/thunk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace win32;
+
+static int failures = 0;
+
+#define CHECK(expr) \
+    do { if (!(expr)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); ++failures; } } while (0)
+
+struct comparator {
+    int calls = 0;
+    bool descending = false;
+};
+
+static uintptr_t compare(void* context, uintptr_t const* args) {
+    auto& c = *(comparator*)context;
+    ++c.calls;
+    int a = *(int const*)args[0];
+    int b = *(int const*)args[1];
+    int r = (a > b) - (a < b);
+    return (uintptr_t)(intptr_t)(c.descending ? -r : r);
+}
+
+// A library entry taking a C callback, called through a thunk like native code would.
+static void sort_ints(int* v, size_t n, void* thunk) {
+    qsort(v, n, sizeof(int), (int (*)(void const*, void const*))thunk);
+}
+
+static void test_qsort() {
+    comparator up, down;
+    down.descending = true;
+    void* up_thunk = acquire_thunk(2, compare, &up);
+    void* down_thunk = acquire_thunk(2, compare, &down);
+    CHECK(up_thunk && down_thunk && up_thunk != down_thunk);
+    int v[] = { 5, -3, 9, 0, 7, 7, -11, 2 };
+    size_t n = sizeof(v) / sizeof(v[0]);
+    sort_ints(v, n, up_thunk);
+    for (size_t i = 1; i < n; ++i) {
+        CHECK(v[i - 1] <= v[i]);
+    }
+    sort_ints(v, n, down_thunk);
+    for (size_t i = 1; i < n; ++i) {
+        CHECK(v[i - 1] >= v[i]);
+    }
+    CHECK(up.calls > 0 && down.calls > 0);
+    release_thunk(2, up_thunk);
+    release_thunk(2, down_thunk);
+}
+
+static uintptr_t identity(void* context, uintptr_t const* args) {
+    return (uintptr_t)context + args[0];
+}
+
+static void test_growth() {
+    // Every slot of every chunk routes to its own context.
+    std::vector<void*> entries;
+    for (size_t i = 0; i < thunk_pool_size; ++i) {
+        void* e = acquire_thunk(1, identity, (void*)(i * 16));
+        CHECK(e != nullptr);
+        entries.push_back(e);
+    }
+    CHECK(acquire_thunk(1, identity, nullptr) == nullptr);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        CHECK(((function_type<1>)entries[i])(3) == i * 16 + 3);
+    }
+    // A released slot, even in a late chunk, is handed out again.
+    void* late = entries[thunk_pool_size - 5];
+    release_thunk(1, late);
+    CHECK(((function_type<1>)late)(3) == 0);
+    CHECK(acquire_thunk(1, identity, (void*)1000) == late);
+    CHECK(((function_type<1>)late)(3) == 1003);
+    for (auto e : entries) {
+        release_thunk(1, e);
+    }
+}
+
+static uintptr_t sum9(void* context, uintptr_t const* args) {
+    uintptr_t r = (uintptr_t)context;
+    for (size_t i = 0; i < 9; ++i) {
+        r += args[i];
+    }
+    return r;
+}
+
+static void test_concurrent() {
+    constexpr int threads = 8;
+    constexpr int rounds = 2000;
+    std::vector<std::thread> pool;
+    std::vector<int> errors(threads);
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([t, &errors] {
+            for (int i = 0; i < rounds; ++i) {
+                void* e = acquire_thunk(9, sum9, (void*)(uintptr_t)t);
+                if (!e) {
+                    ++errors[t];
+                    continue;
+                }
+                if (((function_type<9>)e)(1, 2, 3, 4, 5, 6, 7, 8, 9) != (uintptr_t)t + 45) {
+                    ++errors[t];
+                }
+                release_thunk(9, e);
+            }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    for (int e : errors) {
+        CHECK(e == 0);
+    }
+}
+
+struct gate {
+    std::atomic<bool> entered { false };
+    std::atomic<bool> open { false };
+    std::atomic<bool> retired { false };
+    std::atomic<int> retires { 0 };
+    std::atomic<int> late_calls { 0 };
+};
+
+static uintptr_t wait_gate(void* context, uintptr_t const*) {
+    auto& g = *(gate*)context;
+    if (g.retired.load()) {
+        ++g.late_calls;
+    }
+    g.entered.store(true);
+    while (!g.open.load()) {
+        std::this_thread::yield();
+    }
+    return 7;
+}
+
+static void retire_gate(void* context) {
+    auto& g = *(gate*)context;
+    g.retired.store(true);
+    ++g.retires;
+}
+
+static void test_retire() {
+    // The context is retired only after the call inside it has returned.
+    gate g;
+    void* e = acquire_thunk(0, wait_gate, &g);
+    CHECK(e != nullptr);
+    uintptr_t result = 0;
+    std::thread caller([&] { result = ((function_type<0>)e)(); });
+    while (!g.entered.load()) {
+        std::this_thread::yield();
+    }
+    release_thunk(0, e, retire_gate);
+    CHECK(g.retires.load() == 0);
+    CHECK(((function_type<0>)e)() == 0);
+    g.open.store(true);
+    caller.join();
+    CHECK(result == 7);
+    CHECK(g.retires.load() == 1);
+
+    // Without calls it is retired on the spot, and the slot is reused.
+    gate idle;
+    idle.open.store(true);
+    e = acquire_thunk(0, wait_gate, &idle);
+    release_thunk(0, e, retire_gate);
+    CHECK(idle.retires.load() == 1);
+    void* again = acquire_thunk(0, wait_gate, &idle);
+    CHECK(again == e);
+    release_thunk(0, again);
+}
+
+static void test_retire_concurrent() {
+    // Callers hammer an entry while it is released: one retire, and no dispatch after it.
+    constexpr int threads = 4;
+    for (int round = 0; round < 200; ++round) {
+        gate g;
+        g.open.store(true);
+        void* e = acquire_thunk(0, wait_gate, &g);
+        std::atomic<bool> stop { false };
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back([&] {
+                while (!stop.load()) {
+                    ((function_type<0>)e)();
+                }
+            });
+        }
+        std::this_thread::yield();
+        release_thunk(0, e, retire_gate);
+        stop.store(true);
+        for (auto& t : pool) {
+            t.join();
+        }
+        CHECK(g.retires.load() == 1);
+        CHECK(g.late_calls.load() == 0);
+    }
+}
+
+int main() {
+    test_qsort();
+    test_growth();
+    test_concurrent();
+    test_retire();
+    test_retire_concurrent();
+    if (failures) {
+        fprintf(stderr, "%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("test_thunk: ok\n");
+    return 0;
+}
@@ -503,6 +503,21 @@ namespace winmd::reader
         return get_target_row<TypeDef>(2);
     }
 
+    inline bool operator<(ClassLayout const& left, TypeDef const& right) noexcept
+    {
+        return left.Parent() < right;
+    }
+
+    inline bool operator<(TypeDef const& left, ClassLayout const& right) noexcept
+    {
+        return left < right.Parent();
+    }
+
+    inline auto FieldLayout::Field() const
+    {
+        return get_target_row<reader::Field>(1);
+    }
+
     inline TypeDef NestedClass::NestedType() const
     {
         return get_target_row<TypeDef>(0);
@@ -30,6 +30,26 @@ namespace winmd::reader
         }
     }
 
+    // Finds the enum types that attribute arguments refer to. The owner of the metadata
+    // implements it: attribute values don't depend on the reader's own type cache.
+    struct type_resolver
+    {
+        // Empty row when the type isn't defined in this metadata.
+        virtual TypeDef resolve(TypeRef const& type) const = 0;
+        // Namespace-qualified name, as stored in named arguments.
+        virtual TypeDef resolve(std::string_view const& type_string) const = 0;
+
+    protected:
+        ~type_resolver() = default;
+    };
+
+    // Enums of the base class library aren't defined in a .winmd. Those used by attributes
+    // (CallingConvention, CharSet, LayoutKind, AttributeTargets...) are all int32 based.
+    inline bool is_system_enum(std::string_view const& type_namespace)
+    {
+        return type_namespace == "System" || type_namespace.substr(0, 7) == "System.";
+    }
+
     struct ElemSig
     {
         struct SystemType
@@ -53,8 +73,8 @@ namespace winmd::reader
 
         using value_type = std::variant<bool, char16_t, uint8_t, int8_t, uint16_t, int16_t, uint32_t, int32_t, uint64_t, int64_t, float, double, std::string_view, SystemType, EnumValue>;
 
-        ElemSig(database const& db, ParamSig const& param, byte_view& data)
-            : value{ read_element(db, param, data) }
+        ElemSig(type_resolver const& types, ParamSig const& param, byte_view& data)
+            : value{ read_element(types, param, data) }
         {
         }
 
@@ -73,7 +93,7 @@ namespace winmd::reader
         {
         }
 
-        static value_type read_element(database const& db, ParamSig const& param, byte_view& data)
+        static value_type read_element(type_resolver const& types, ParamSig const& param, byte_view& data)
         {
             auto const& type = param.Type().Type();
             if (auto element_type = std::get_if<ElementType>(&type))
@@ -90,16 +110,24 @@ namespace winmd::reader
                 else
                 {
                     // Should be an enum. Resolve it.
-                    auto resolve_type = [&db, &type_index]() -> TypeDef
+                    TypeDef enum_type;
+                    if (type_index->type() == TypeDefOrRef::TypeDef)
                     {
-                        if (type_index->type() == TypeDefOrRef::TypeDef)
+                        enum_type = type_index->TypeDef();
+                    }
+                    else
+                    {
+                        auto const& typeref = type_index->TypeRef();
+                        enum_type = types.resolve(typeref);
+                        if (!enum_type)
                         {
-                            return type_index->TypeDef();
+                            if (is_system_enum(typeref.TypeNamespace()))
+                            {
+                                return read<int32_t>(data);
+                            }
+                            impl::throw_invalid("Type '", typeref.TypeNamespace(), ".", typeref.TypeName(), "' could not be found");
                         }
-                        auto const& typeref = type_index->TypeRef();
-                        return db.get_cache().find_required(typeref.TypeNamespace(), typeref.TypeName());
-                    };
-                    TypeDef const& enum_type = resolve_type();
+                    }
                     if (!enum_type.is_enum())
                     {
                         impl::throw_invalid("CustomAttribute params that are TypeDefOrRef must be an enum or System.Type");
@@ -206,8 +234,8 @@ namespace winmd::reader
     {
         using value_type = std::variant<ElemSig, std::vector<ElemSig>>;
 
-        FixedArgSig(database const& db, ParamSig const& ctor_param, byte_view& data)
-            : value{ read_arg(db, ctor_param, data) }
+        FixedArgSig(type_resolver const& types, ParamSig const& ctor_param, byte_view& data)
+            : value{ read_arg(types, ctor_param, data) }
         {}
 
         FixedArgSig(ElemSig::SystemType type)
@@ -222,7 +250,7 @@ namespace winmd::reader
             : value{ read_arg(type, is_array, data) }
         {}
 
-        static value_type read_arg(database const& db, ParamSig const& ctor_param, byte_view& data)
+        static value_type read_arg(type_resolver const& types, ParamSig const& ctor_param, byte_view& data)
         {
             auto const& type_sig = ctor_param.Type();
             if (type_sig.is_szarray())
@@ -238,14 +266,14 @@ namespace winmd::reader
                     elems.reserve(num_elements);
                     for (uint32_t i = 0; i < num_elements; ++i)
                     {
-                        elems.emplace_back(db, ctor_param, data);
+                        elems.emplace_back(types, ctor_param, data);
                     }
                 }
                 return elems;
             }
             else
             {
-                return ElemSig{ db, ctor_param, data };
+                return ElemSig{ types, ctor_param, data };
             }
         }
 
@@ -280,15 +308,15 @@ namespace winmd::reader
 
     struct NamedArgSig
     {
-        NamedArgSig(database const& db, byte_view& data)
-            : value{ parse_value(db, data) }
+        NamedArgSig(type_resolver const& types, byte_view& data)
+            : value{ parse_value(types, data) }
         {}
 
         std::string_view name;
         FixedArgSig value;
 
     private:
-        FixedArgSig parse_value(database const& db, byte_view& data)
+        FixedArgSig parse_value(type_resolver const& types, byte_view& data)
         {
             auto const field_or_prop = read<ElementType>(data);
             if (field_or_prop != ElementType::Field && field_or_prop != ElementType::Property)
@@ -307,9 +335,15 @@ namespace winmd::reader
             {
                 auto type_string = read<std::string_view>(data);
                 name = read<std::string_view>(data);
-                auto type_def = db.get_cache().find(type_string);
+                // Types of other assemblies are written assembly-qualified: "Name, Assembly, Version=...".
+                type_string = type_string.substr(0, type_string.find(','));
+                auto type_def = types.resolve(type_string);
                 if (!type_def)
                 {
+                    if (is_system_enum(type_string.substr(0, type_string.rfind('.'))))
+                    {
+                        return FixedArgSig{ ElementType::I4, false, data };
+                    }
                     impl::throw_invalid("CustomAttribute named param referenced unresolved enum type");
                 }
                 if (!type_def.is_enum())
@@ -340,9 +374,8 @@ namespace winmd::reader
 
     struct CustomAttributeSig
     {
-        CustomAttributeSig(table_base const* table, byte_view& data, MethodDefSig const& ctor)
+        CustomAttributeSig(type_resolver const& types, byte_view& data, MethodDefSig const& ctor)
         {
-            database const& db = table->get_database();
             auto const prolog = read<uint16_t>(data);
             if (prolog != 0x0001)
             {
@@ -351,7 +384,7 @@ namespace winmd::reader
 
             for (auto const& param : ctor.Params())
             {
-                m_fixed_args.push_back(FixedArgSig{ db, param, data });
+                m_fixed_args.push_back(FixedArgSig{ types, param, data });
             }
 
             const auto num_named_args = read<uint16_t>(data);
@@ -363,7 +396,7 @@ namespace winmd::reader
 
             for (uint16_t i = 0; i < num_named_args; ++i)
             {
-                m_named_args.emplace_back(db, data);
+                m_named_args.emplace_back(types, data);
             }
         }
 
@@ -375,11 +408,11 @@ namespace winmd::reader
         std::vector<NamedArgSig> m_named_args;
     };
 
-    inline auto CustomAttribute::Value() const
+    inline auto CustomAttribute::Value(type_resolver const& types) const
     {
         auto const ctor = Type();
         MethodDefSig const& method_sig = ctor.type() == CustomAttributeType::MemberRef ? ctor.MemberRef().MethodSignature() : ctor.MethodDef().Signature();
         auto cursor = get_blob(2);
-        return CustomAttributeSig{ get_table(), cursor, method_sig };
+        return CustomAttributeSig{ types, cursor, method_sig };
     }
 }
@@ -13,6 +13,66 @@ namespace winmd::reader
         return range.second - range.first;
     }
 
+    // Tables keyed by a parent column (Constant, CustomAttribute, FieldMarshal, ClassLayout...)
+    // are sorted by that column, so a whole-table pass can group rows in one linear scan.
+    // Calls callback(parent, children) once per distinct parent, in parent order.
+    template <typename Row, typename Callback>
+    void for_each_parent(table<Row> const& rows, Callback&& callback)
+    {
+        auto const last = rows.end();
+        for (auto first = rows.begin(); first != last;)
+        {
+            auto const parent = first.Parent();
+            auto next = first + 1;
+            while (next != last && next.Parent() == parent)
+            {
+                ++next;
+            }
+            callback(parent, std::pair<Row, Row>{ first, next });
+            first = next;
+        }
+    }
+
+    // Merge join of a parent-keyed table against parents visited in ascending order:
+    // each seek resumes where the previous one stopped instead of searching the whole table.
+    template <typename Row>
+    struct parent_cursor
+    {
+        explicit parent_cursor(table<Row> const& rows) noexcept :
+            m_current(rows.begin()),
+            m_last(rows.end())
+        {
+        }
+
+        // Starts at the first row of a given parent, for joins over a slice of the parents.
+        template <typename Key>
+        parent_cursor(table<Row> const& rows, Key const& first_parent) noexcept :
+            m_current(std::lower_bound(rows.begin(), rows.end(), first_parent)),
+            m_last(rows.end())
+        {
+        }
+
+        template <typename Key>
+        std::pair<Row, Row> seek(Key const& parent) noexcept
+        {
+            while (m_current != m_last && m_current < parent)
+            {
+                ++m_current;
+            }
+            auto const first = m_current;
+            while (m_current != m_last && !(parent < m_current))
+            {
+                ++m_current;
+            }
+            return { first, m_current };
+        }
+
+    private:
+
+        Row m_current;
+        Row m_last;
+    };
+
     inline auto find(TypeRef const& type)
     {
         if (type.ResolutionScope().type() != ResolutionScope::TypeRef)
@@ -141,6 +141,21 @@ namespace winmd::impl
         uint32_t Characteristics;
     };
 
+    struct image_export_directory
+    {
+        uint32_t Characteristics;
+        uint32_t TimeDateStamp;
+        uint16_t MajorVersion;
+        uint16_t MinorVersion;
+        uint32_t Name;
+        uint32_t Base;
+        uint32_t NumberOfFunctions;
+        uint32_t NumberOfNames;
+        uint32_t AddressOfFunctions;
+        uint32_t AddressOfNames;
+        uint32_t AddressOfNameOrdinals;
+    };
+
     struct image_cor20_header
     {
         uint32_t cb;
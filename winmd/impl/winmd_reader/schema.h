@@ -37,7 +37,7 @@ namespace winmd::reader
             return get_coded_index<CustomAttributeType>(1);
         }
 
-        auto Value() const;
+        auto Value(type_resolver const& types) const;
 
         auto TypeNamespaceAndName() const;
     };
@@ -304,6 +304,13 @@ namespace winmd::reader
     struct FieldLayout : row_base<FieldLayout>
     {
         using row_base::row_base;
+
+        auto Offset() const
+        {
+            return get_value<uint32_t>(0);
+        }
+
+        auto Field() const;
     };
 
     struct StandAloneSig : row_base<StandAloneSig>
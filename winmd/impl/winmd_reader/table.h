@@ -3,6 +3,7 @@ namespace winmd::reader
 {
     struct database;
     struct cache;
+    struct type_resolver;
 
     struct table_base
     {